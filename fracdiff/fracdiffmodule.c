@@ -0,0 +1,145 @@
+//
+//  fracdiffmodule.c
+//  fracdiff
+
+// Python binding for the fracdiff routines in main.c, using only the CPython C API
+// (no numpy, cython, or other third party packages needed, to build or to run).
+
+// Build (from this directory), on linux:
+
+// cc -O2 -shared -fPIC $(python3-config --includes) fracdiffmodule.c -o fracdiff$(python3-config --extension-suffix) -lpthread
+
+// on Mac, add -undefined dynamic_lookup to the above.
+// Then in Python:
+
+//   import fracdiff, array
+//   x = array.array('f', [2, 1, 3, 5, 6, 0, -1, 2, 2, 5])
+//   out = array.array('f', bytes(4 * len(x)))
+//   fracdiff.fracdiff(x, 0.5, out=out)       # same numbers as fracDiff(x, 10, 0.5, 0, 0) in main.c
+
+// The series can be any object with the buffer protocol holding contiguous float32 ('f') or float64 ('d') values:
+// array.array, numpy arrays, memoryviews, mmap'd files, ...
+// float32 input is read in place and float32 output is written in place, no copies at all.
+// float64 has to be converted for the float kernels, so a float64 series or output costs one temporary float array.
+
+// The GIL is released while fracDiff runs, so several Python threads can run fracdiff at the same time
+// on different cores.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// pull in the C routines without their demo main(), and without the debug printf's in the weight loop
+#define FRACDIFF_NO_MAIN
+#define printf(...)
+#include "main.c"
+#undef printf
+
+// get a contiguous float32 or float64 buffer, returns 0 and sets a Python exception on failure
+
+static int fdGetBuffer(PyObject * obj, Py_buffer * view, int writable, const char * name) {
+
+    int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+    if (PyObject_GetBuffer(obj, view, flags) != 0) return 0;
+
+    const char * f = view->format ? view->format : "B";
+    if (*f == '@' || *f == '=' || *f == '<') f++; // native byte order
+    if ((strcmp(f, "f") != 0 || view->itemsize != 4) && (strcmp(f, "d") != 0 || view->itemsize != 8)) {
+        PyErr_Format(PyExc_TypeError, "%s must hold float32 or float64 values, got format '%s'", name, view->format);
+        PyBuffer_Release(view);
+        return 0;
+    }
+    if (view->len / view->itemsize > INT_MAX) {
+        PyErr_Format(PyExc_ValueError, "%s is too long", name);
+        PyBuffer_Release(view);
+        return 0;
+    }
+    return 1;
+}
+
+static PyObject * py_fracdiff(PyObject * self, PyObject * args, PyObject * kwargs) {
+
+    static char * kwlist[] = {"series", "d", "threshold", "nweights", "out", NULL};
+    PyObject * seriesObj;
+    PyObject * outObj = Py_None;
+    float d, threshold = 0;
+    int useNWeights = 0;
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Of|fiO", kwlist, &seriesObj, &d, &threshold, &useNWeights, &outObj))
+        return NULL;
+
+    Py_buffer in, out;
+    if (!fdGetBuffer(seriesObj, &in, 0, "series")) return NULL;
+    int len = (int)(in.len / in.itemsize);
+
+    // no output buffer given:  make a float32 one (a bytearray, returned as a memoryview of floats)
+    if (outObj == Py_None) {
+        PyObject * bytes = PyByteArray_FromStringAndSize(NULL, (Py_ssize_t)len * 4);
+        if (!bytes) {
+            PyBuffer_Release(&in);
+            return NULL;
+        }
+        PyObject * mv = PyMemoryView_FromObject(bytes);
+        Py_DECREF(bytes);
+        outObj = mv ? PyObject_CallMethod(mv, "cast", "s", "f") : NULL;
+        Py_XDECREF(mv);
+        if (!outObj) {
+            PyBuffer_Release(&in);
+            return NULL;
+        }
+    } else {
+        Py_INCREF(outObj);
+    }
+
+    if (!fdGetBuffer(outObj, &out, 1, "out")) {
+        PyBuffer_Release(&in);
+        Py_DECREF(outObj);
+        return NULL;
+    }
+    if (out.len / out.itemsize != len) {
+        PyErr_Format(PyExc_ValueError, "out has %zd values, series has %d", out.len / out.itemsize, len);
+        PyBuffer_Release(&in);
+        PyBuffer_Release(&out);
+        Py_DECREF(outObj);
+        return NULL;
+    }
+
+    if (len > 0) {
+        Py_BEGIN_ALLOW_THREADS
+
+        // float64 in or out goes through a float temporary, float32 is used in place
+        float * x = in.itemsize == 4 ? (float *)in.buf : malloc(len * sizeof(float));
+        float * y = out.itemsize == 4 ? (float *)out.buf : malloc(len * sizeof(float));
+        if (in.itemsize == 8) for (int i = 0; i < len; i++) x[i] = (float)((double *)in.buf)[i];
+
+        fracDiffInto(x, len, d, threshold, useNWeights, y);
+
+        if (out.itemsize == 8) for (int i = 0; i < len; i++) ((double *)out.buf)[i] = y[i];
+        if (x != in.buf) free(x);
+        if (y != out.buf) free(y);
+
+        Py_END_ALLOW_THREADS
+    }
+
+    PyBuffer_Release(&in);
+    PyBuffer_Release(&out);
+    return outObj;
+}
+
+static PyMethodDef fdMethods[] = {
+    {"fracdiff", (PyCFunction)(void (*)(void))py_fracdiff, METH_VARARGS | METH_KEYWORDS,
+     "fracdiff(series, d, threshold=0.0, nweights=0, out=None)\n\n"
+     "Fractional difference of series (most recent value first), same as fracDiff() in main.c.\n"
+     "series and out are float32 or float64 buffers of the same length; float32 ones are used in place.\n"
+     "If out is not given a float32 memoryview is allocated.  Returns out."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef fdModule = {
+    PyModuleDef_HEAD_INIT, "fracdiff", "Fractional differencing (C kernels from main.c)", -1, fdMethods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_fracdiff(void) {
+    return PyModule_Create(&fdModule);
+}
@@ -112,10 +112,31 @@
 // This C code is easily translatable to a variety of other languages as well, since
 // it is low level.
 
+// needed for the thread pinning calls on linux, must come before any #include
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// x86 SIMD intrinsics are only used when the compiler is told the CPU has them (e.g. -mf16c or -march=native),
+// otherwise plain C versions of the same loops are used
+#if defined(__F16C__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h> // MXCSR access for the denormal flushing around the kernels
+#endif
 
 // uncomment to turn on printf statements for testing
 //#define printf(...)
@@ -126,9 +147,11 @@
 
 // on a linux type system or mac, you can also compile and run this routine like this:
 
-// gcc main.c
+// gcc main.c -lm -lpthread
 // ./a.out (default executable name is a.out from gcc compiler)
 
+// (-lm for the math library, on Mac it isn't needed; -lpthread is for the thread pool, see there)
+
 // On Mac, the gcc command didnt need the standard c library to be added to the gcc command,
 // but you may have to specify a -L and/or -l argument to add a system library or two
 // if you are on some type of linux or windows system.  However, if you regularly
@@ -162,6 +185,7 @@ float * findWeights_ffd(float d, int length, float threshold, int useNWeights) {
         w_curr = (-w[wcount-1]*(d-k+1))/k; // [A] the main recurrence relation for weights
         printf("w_curr = %f\n", w_curr);
         if (fabsf(w_curr) <= threshold) break;
+        if (fabsf(w_curr) < FLT_MIN) break; // stop before the weights go subnormal, see fdDroppedMass() below
         if (useNWeights > 0 && k >= useNWeights) break;
         
         w[wcount] = w_curr; // add an item to the weights array and
@@ -172,6 +196,182 @@ float * findWeights_ffd(float d, int length, float threshold, int useNWeights) {
 
 }
 
+// ----
+// Compile time weight tables for a few common d values
+
+// A handful of d values (0.3, 0.4, 0.5) with windows of up to 128 weights cover most uses, so for those the
+// weights are worked out by the compiler and stored as read only data:  no weight computation at startup
+// and no allocation.  Standard C has no constexpr functions, but the recurrence [A] can be written out as a chain
+// of macros, FD_Wk(d) being the k-th weight, built from the (k-1)-th exactly as findWeights_ffd() does it, in float.
+// The compiler folds each one into a constant using the same float arithmetic (round to nearest) the loop would use
+// at run time, so the tables match findWeights_ffd() bit for bit (the demo in main() checks this).
+// Each level is cast to float, which rounds it the same way the run time loop's store into w_curr does, even where
+// the compiler evaluates float expressions in more precision (FLT_EVAL_METHOD != 0, e.g. x87).
+// For the same reason the d constants are cast too:  there even a literal like 0.3f can carry more precision
+// than the float d passed in at run time.
+
+#define FD_W0(d) 1.0f
+#define FD_W1(d) ((float)((-FD_W0(d)*((d)-1+1))/1))
+#define FD_W2(d) ((float)((-FD_W1(d)*((d)-2+1))/2))
+#define FD_W3(d) ((float)((-FD_W2(d)*((d)-3+1))/3))
+#define FD_W4(d) ((float)((-FD_W3(d)*((d)-4+1))/4))
+#define FD_W5(d) ((float)((-FD_W4(d)*((d)-5+1))/5))
+#define FD_W6(d) ((float)((-FD_W5(d)*((d)-6+1))/6))
+#define FD_W7(d) ((float)((-FD_W6(d)*((d)-7+1))/7))
+#define FD_W8(d) ((float)((-FD_W7(d)*((d)-8+1))/8))
+#define FD_W9(d) ((float)((-FD_W8(d)*((d)-9+1))/9))
+#define FD_W10(d) ((float)((-FD_W9(d)*((d)-10+1))/10))
+#define FD_W11(d) ((float)((-FD_W10(d)*((d)-11+1))/11))
+#define FD_W12(d) ((float)((-FD_W11(d)*((d)-12+1))/12))
+#define FD_W13(d) ((float)((-FD_W12(d)*((d)-13+1))/13))
+#define FD_W14(d) ((float)((-FD_W13(d)*((d)-14+1))/14))
+#define FD_W15(d) ((float)((-FD_W14(d)*((d)-15+1))/15))
+#define FD_W16(d) ((float)((-FD_W15(d)*((d)-16+1))/16))
+#define FD_W17(d) ((float)((-FD_W16(d)*((d)-17+1))/17))
+#define FD_W18(d) ((float)((-FD_W17(d)*((d)-18+1))/18))
+#define FD_W19(d) ((float)((-FD_W18(d)*((d)-19+1))/19))
+#define FD_W20(d) ((float)((-FD_W19(d)*((d)-20+1))/20))
+#define FD_W21(d) ((float)((-FD_W20(d)*((d)-21+1))/21))
+#define FD_W22(d) ((float)((-FD_W21(d)*((d)-22+1))/22))
+#define FD_W23(d) ((float)((-FD_W22(d)*((d)-23+1))/23))
+#define FD_W24(d) ((float)((-FD_W23(d)*((d)-24+1))/24))
+#define FD_W25(d) ((float)((-FD_W24(d)*((d)-25+1))/25))
+#define FD_W26(d) ((float)((-FD_W25(d)*((d)-26+1))/26))
+#define FD_W27(d) ((float)((-FD_W26(d)*((d)-27+1))/27))
+#define FD_W28(d) ((float)((-FD_W27(d)*((d)-28+1))/28))
+#define FD_W29(d) ((float)((-FD_W28(d)*((d)-29+1))/29))
+#define FD_W30(d) ((float)((-FD_W29(d)*((d)-30+1))/30))
+#define FD_W31(d) ((float)((-FD_W30(d)*((d)-31+1))/31))
+#define FD_W32(d) ((float)((-FD_W31(d)*((d)-32+1))/32))
+#define FD_W33(d) ((float)((-FD_W32(d)*((d)-33+1))/33))
+#define FD_W34(d) ((float)((-FD_W33(d)*((d)-34+1))/34))
+#define FD_W35(d) ((float)((-FD_W34(d)*((d)-35+1))/35))
+#define FD_W36(d) ((float)((-FD_W35(d)*((d)-36+1))/36))
+#define FD_W37(d) ((float)((-FD_W36(d)*((d)-37+1))/37))
+#define FD_W38(d) ((float)((-FD_W37(d)*((d)-38+1))/38))
+#define FD_W39(d) ((float)((-FD_W38(d)*((d)-39+1))/39))
+#define FD_W40(d) ((float)((-FD_W39(d)*((d)-40+1))/40))
+#define FD_W41(d) ((float)((-FD_W40(d)*((d)-41+1))/41))
+#define FD_W42(d) ((float)((-FD_W41(d)*((d)-42+1))/42))
+#define FD_W43(d) ((float)((-FD_W42(d)*((d)-43+1))/43))
+#define FD_W44(d) ((float)((-FD_W43(d)*((d)-44+1))/44))
+#define FD_W45(d) ((float)((-FD_W44(d)*((d)-45+1))/45))
+#define FD_W46(d) ((float)((-FD_W45(d)*((d)-46+1))/46))
+#define FD_W47(d) ((float)((-FD_W46(d)*((d)-47+1))/47))
+#define FD_W48(d) ((float)((-FD_W47(d)*((d)-48+1))/48))
+#define FD_W49(d) ((float)((-FD_W48(d)*((d)-49+1))/49))
+#define FD_W50(d) ((float)((-FD_W49(d)*((d)-50+1))/50))
+#define FD_W51(d) ((float)((-FD_W50(d)*((d)-51+1))/51))
+#define FD_W52(d) ((float)((-FD_W51(d)*((d)-52+1))/52))
+#define FD_W53(d) ((float)((-FD_W52(d)*((d)-53+1))/53))
+#define FD_W54(d) ((float)((-FD_W53(d)*((d)-54+1))/54))
+#define FD_W55(d) ((float)((-FD_W54(d)*((d)-55+1))/55))
+#define FD_W56(d) ((float)((-FD_W55(d)*((d)-56+1))/56))
+#define FD_W57(d) ((float)((-FD_W56(d)*((d)-57+1))/57))
+#define FD_W58(d) ((float)((-FD_W57(d)*((d)-58+1))/58))
+#define FD_W59(d) ((float)((-FD_W58(d)*((d)-59+1))/59))
+#define FD_W60(d) ((float)((-FD_W59(d)*((d)-60+1))/60))
+#define FD_W61(d) ((float)((-FD_W60(d)*((d)-61+1))/61))
+#define FD_W62(d) ((float)((-FD_W61(d)*((d)-62+1))/62))
+#define FD_W63(d) ((float)((-FD_W62(d)*((d)-63+1))/63))
+#define FD_W64(d) ((float)((-FD_W63(d)*((d)-64+1))/64))
+#define FD_W65(d) ((float)((-FD_W64(d)*((d)-65+1))/65))
+#define FD_W66(d) ((float)((-FD_W65(d)*((d)-66+1))/66))
+#define FD_W67(d) ((float)((-FD_W66(d)*((d)-67+1))/67))
+#define FD_W68(d) ((float)((-FD_W67(d)*((d)-68+1))/68))
+#define FD_W69(d) ((float)((-FD_W68(d)*((d)-69+1))/69))
+#define FD_W70(d) ((float)((-FD_W69(d)*((d)-70+1))/70))
+#define FD_W71(d) ((float)((-FD_W70(d)*((d)-71+1))/71))
+#define FD_W72(d) ((float)((-FD_W71(d)*((d)-72+1))/72))
+#define FD_W73(d) ((float)((-FD_W72(d)*((d)-73+1))/73))
+#define FD_W74(d) ((float)((-FD_W73(d)*((d)-74+1))/74))
+#define FD_W75(d) ((float)((-FD_W74(d)*((d)-75+1))/75))
+#define FD_W76(d) ((float)((-FD_W75(d)*((d)-76+1))/76))
+#define FD_W77(d) ((float)((-FD_W76(d)*((d)-77+1))/77))
+#define FD_W78(d) ((float)((-FD_W77(d)*((d)-78+1))/78))
+#define FD_W79(d) ((float)((-FD_W78(d)*((d)-79+1))/79))
+#define FD_W80(d) ((float)((-FD_W79(d)*((d)-80+1))/80))
+#define FD_W81(d) ((float)((-FD_W80(d)*((d)-81+1))/81))
+#define FD_W82(d) ((float)((-FD_W81(d)*((d)-82+1))/82))
+#define FD_W83(d) ((float)((-FD_W82(d)*((d)-83+1))/83))
+#define FD_W84(d) ((float)((-FD_W83(d)*((d)-84+1))/84))
+#define FD_W85(d) ((float)((-FD_W84(d)*((d)-85+1))/85))
+#define FD_W86(d) ((float)((-FD_W85(d)*((d)-86+1))/86))
+#define FD_W87(d) ((float)((-FD_W86(d)*((d)-87+1))/87))
+#define FD_W88(d) ((float)((-FD_W87(d)*((d)-88+1))/88))
+#define FD_W89(d) ((float)((-FD_W88(d)*((d)-89+1))/89))
+#define FD_W90(d) ((float)((-FD_W89(d)*((d)-90+1))/90))
+#define FD_W91(d) ((float)((-FD_W90(d)*((d)-91+1))/91))
+#define FD_W92(d) ((float)((-FD_W91(d)*((d)-92+1))/92))
+#define FD_W93(d) ((float)((-FD_W92(d)*((d)-93+1))/93))
+#define FD_W94(d) ((float)((-FD_W93(d)*((d)-94+1))/94))
+#define FD_W95(d) ((float)((-FD_W94(d)*((d)-95+1))/95))
+#define FD_W96(d) ((float)((-FD_W95(d)*((d)-96+1))/96))
+#define FD_W97(d) ((float)((-FD_W96(d)*((d)-97+1))/97))
+#define FD_W98(d) ((float)((-FD_W97(d)*((d)-98+1))/98))
+#define FD_W99(d) ((float)((-FD_W98(d)*((d)-99+1))/99))
+#define FD_W100(d) ((float)((-FD_W99(d)*((d)-100+1))/100))
+#define FD_W101(d) ((float)((-FD_W100(d)*((d)-101+1))/101))
+#define FD_W102(d) ((float)((-FD_W101(d)*((d)-102+1))/102))
+#define FD_W103(d) ((float)((-FD_W102(d)*((d)-103+1))/103))
+#define FD_W104(d) ((float)((-FD_W103(d)*((d)-104+1))/104))
+#define FD_W105(d) ((float)((-FD_W104(d)*((d)-105+1))/105))
+#define FD_W106(d) ((float)((-FD_W105(d)*((d)-106+1))/106))
+#define FD_W107(d) ((float)((-FD_W106(d)*((d)-107+1))/107))
+#define FD_W108(d) ((float)((-FD_W107(d)*((d)-108+1))/108))
+#define FD_W109(d) ((float)((-FD_W108(d)*((d)-109+1))/109))
+#define FD_W110(d) ((float)((-FD_W109(d)*((d)-110+1))/110))
+#define FD_W111(d) ((float)((-FD_W110(d)*((d)-111+1))/111))
+#define FD_W112(d) ((float)((-FD_W111(d)*((d)-112+1))/112))
+#define FD_W113(d) ((float)((-FD_W112(d)*((d)-113+1))/113))
+#define FD_W114(d) ((float)((-FD_W113(d)*((d)-114+1))/114))
+#define FD_W115(d) ((float)((-FD_W114(d)*((d)-115+1))/115))
+#define FD_W116(d) ((float)((-FD_W115(d)*((d)-116+1))/116))
+#define FD_W117(d) ((float)((-FD_W116(d)*((d)-117+1))/117))
+#define FD_W118(d) ((float)((-FD_W117(d)*((d)-118+1))/118))
+#define FD_W119(d) ((float)((-FD_W118(d)*((d)-119+1))/119))
+#define FD_W120(d) ((float)((-FD_W119(d)*((d)-120+1))/120))
+#define FD_W121(d) ((float)((-FD_W120(d)*((d)-121+1))/121))
+#define FD_W122(d) ((float)((-FD_W121(d)*((d)-122+1))/122))
+#define FD_W123(d) ((float)((-FD_W122(d)*((d)-123+1))/123))
+#define FD_W124(d) ((float)((-FD_W123(d)*((d)-124+1))/124))
+#define FD_W125(d) ((float)((-FD_W124(d)*((d)-125+1))/125))
+#define FD_W126(d) ((float)((-FD_W125(d)*((d)-126+1))/126))
+#define FD_W127(d) ((float)((-FD_W126(d)*((d)-127+1))/127))
+
+#define FD_WEIGHTS_128(d) \
+    FD_W0(d), FD_W1(d), FD_W2(d), FD_W3(d), FD_W4(d), FD_W5(d), FD_W6(d), FD_W7(d), \
+    FD_W8(d), FD_W9(d), FD_W10(d), FD_W11(d), FD_W12(d), FD_W13(d), FD_W14(d), FD_W15(d), \
+    FD_W16(d), FD_W17(d), FD_W18(d), FD_W19(d), FD_W20(d), FD_W21(d), FD_W22(d), FD_W23(d), \
+    FD_W24(d), FD_W25(d), FD_W26(d), FD_W27(d), FD_W28(d), FD_W29(d), FD_W30(d), FD_W31(d), \
+    FD_W32(d), FD_W33(d), FD_W34(d), FD_W35(d), FD_W36(d), FD_W37(d), FD_W38(d), FD_W39(d), \
+    FD_W40(d), FD_W41(d), FD_W42(d), FD_W43(d), FD_W44(d), FD_W45(d), FD_W46(d), FD_W47(d), \
+    FD_W48(d), FD_W49(d), FD_W50(d), FD_W51(d), FD_W52(d), FD_W53(d), FD_W54(d), FD_W55(d), \
+    FD_W56(d), FD_W57(d), FD_W58(d), FD_W59(d), FD_W60(d), FD_W61(d), FD_W62(d), FD_W63(d), \
+    FD_W64(d), FD_W65(d), FD_W66(d), FD_W67(d), FD_W68(d), FD_W69(d), FD_W70(d), FD_W71(d), \
+    FD_W72(d), FD_W73(d), FD_W74(d), FD_W75(d), FD_W76(d), FD_W77(d), FD_W78(d), FD_W79(d), \
+    FD_W80(d), FD_W81(d), FD_W82(d), FD_W83(d), FD_W84(d), FD_W85(d), FD_W86(d), FD_W87(d), \
+    FD_W88(d), FD_W89(d), FD_W90(d), FD_W91(d), FD_W92(d), FD_W93(d), FD_W94(d), FD_W95(d), \
+    FD_W96(d), FD_W97(d), FD_W98(d), FD_W99(d), FD_W100(d), FD_W101(d), FD_W102(d), FD_W103(d), \
+    FD_W104(d), FD_W105(d), FD_W106(d), FD_W107(d), FD_W108(d), FD_W109(d), FD_W110(d), FD_W111(d), \
+    FD_W112(d), FD_W113(d), FD_W114(d), FD_W115(d), FD_W116(d), FD_W117(d), FD_W118(d), FD_W119(d), \
+    FD_W120(d), FD_W121(d), FD_W122(d), FD_W123(d), FD_W124(d), FD_W125(d), FD_W126(d), FD_W127(d)
+
+static const float fdWeightsD03[128] = { FD_WEIGHTS_128((float)0.3f) };
+static const float fdWeightsD04[128] = { FD_WEIGHTS_128((float)0.4f) };
+static const float fdWeightsD05[128] = { FD_WEIGHTS_128((float)0.5f) };
+
+// The first nWeights weights for d from the tables, or NULL if d is not one of the tabled values or nWeights > 128.
+// These are the weights findWeights_ffd(d, length, 0, nWeights) gives for any length >= nWeights.
+
+const float * findWeights_ffd_const(float d, int nWeights) {
+    if (nWeights < 1 || nWeights > 128) return NULL;
+    if (d == (float)0.3f) return fdWeightsD03;
+    if (d == (float)0.4f) return fdWeightsD04;
+    if (d == (float)0.5f) return fdWeightsD05;
+    return NULL;
+}
+
 // Fractional differencing:
 // Each item of the output series is merely a weighted sum of all prior values in the series,
 // with weights determined by the recurrence relation at line [A] above.
@@ -205,29 +405,466 @@ float * findWeights_ffd(float d, int length, float threshold, int useNWeights) {
 // characteristic of digital filters:  if you change the weights (e.g. set some to 0), you change the frequency
 // characteristics.
 
-float * fracDiff(float * series, int len, float d, float threshold, int useNWeights) {
+// Deterministic (bit reproducible) mode
+
+// Floating point addition is not associative:  (a+b)+c can differ from a+(b+c) in the last bit or so.
+// So results can change slightly when a sum is done in a different order, e.g. split across SIMD lanes
+// of a different width, or when the compiler fuses a multiply and an add into one FMA instruction on
+// one machine and not on another.  That is harmless numerically but breaks audit diffs.
+
+// In deterministic mode every dot product is summed in a fixed pattern:  FD_LANES running sums, where
+// term j always goes into sum j % FD_LANES, then the lane sums are added up in a fixed pairwise tree.
+// That pattern is the same whatever the vector width (a 4, 8 or 16 wide SIMD unit just does
+// 4, 3, 2 or 1 passes over the lanes), and each output is one such sum whichever thread computes it,
+// so the results are the same bits for any number of threads, any vector width, and any host with IEEE floats.
+// The lanes are also what lets the compiler vectorize the loop, so this mode is usually faster than the
+// plain one-at-a-time sum.
+
+// Turn on with fdSetDeterministic(1).  Affects fracDiff() and everything built on it (threaded, panel, ...).
+// Results differ from the default mode in the last bits, since it is a different (fixed) summation order.
+
+#define FD_LANES 16
+
+static atomic_int fdDeterministic = 0;
+
+void fdSetDeterministic(int on) {
+    atomic_store(&fdDeterministic, on != 0);
+}
+
+// ----
+// Denormals (subnormals)
+
+// Floats smaller than FLT_MIN (about 1e-38) are stored as subnormals, and on x86 every multiply or add that
+// takes or makes one drops to a microcode slow path, 10-100x slower than a normal one.  A long run can then
+// suddenly stall part way through for no visible reason.  Two places this can happen:
+
+// - the weights:  with threshold = 0 the recurrence [A] keeps going until the weights underflow,
+//   so findWeights_ffd() stops as soon as a weight would drop below FLT_MIN instead.
+//   The weights dropped that way (and any cut off by the threshold or useNWeights) are reported by fdDroppedMass().
+// - the products and sums in the kernels, when the series itself has tiny values.  For those the kernels run with
+//   the CPU's flush-to-zero and denormals-are-zero modes on (MXCSR on x86, FPCR on ARM64), just for the
+//   duration of the kernel, and the caller's mode is put back afterwards.  Results only change for values that
+//   would have been subnormal, which are then 0.  fdSetFlushDenormals(0) turns this off.
+
+static atomic_int fdFlushDenormals = 1;
+
+void fdSetFlushDenormals(int on) {
+    atomic_store(&fdFlushDenormals, on != 0);
+}
+
+// turn flush-to-zero / denormals-are-zero on for this thread, returns the old mode for fdDenormalsRestore()
+
+// The saved mode carries its own "changed" flag, so the restore only undoes what this call did, even if
+// another thread calls fdSetFlushDenormals() in between.
+
+typedef struct {
+    uint64_t mode;
+    int changed;
+} fdFpMode;
+
+static fdFpMode fdDenormalsOff(void) {
+    fdFpMode saved = {0, 0};
+    if (!atomic_load(&fdFlushDenormals)) return saved;
+#if defined(__SSE__) || defined(__x86_64__)
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040); // FTZ (bit 15) | DAZ (bit 6)
+    saved = (fdFpMode){csr, 1};
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1ull << 24))); // FZ
+    saved = (fdFpMode){fpcr, 1};
+#endif
+    return saved;
+}
+
+static void fdDenormalsRestore(fdFpMode saved) {
+    if (!saved.changed) return;
+#if defined(__SSE__) || defined(__x86_64__)
+    _mm_setcsr((unsigned int)saved.mode);
+#elif defined(__aarch64__)
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(saved.mode));
+#endif
+}
+
+// fused multiply-add changes the rounding, so it has to be off for the dot product kernels from here down to
+// fdConvolveRange (clang takes the standard pragma, gcc needs its own attribute on each function).
+// Without this the compiler is free to fuse some of the multiply-adds in one loop and not in another,
+// so two loops summing the same terms in the same order could still differ in the last bit.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#define FD_NO_FMA
+#elif defined(__GNUC__)
+#define FD_NO_FMA __attribute__((optimize("fp-contract=off")))
+#else
+#define FD_NO_FMA
+#endif
+
+FD_NO_FMA static float fdDotFixed(const float * x, const float * w, int n) {
     
-    float * weights = findWeights_ffd(d, len, threshold, useNWeights); // generate the weights
+    float acc[FD_LANES] = {0};
+    int j = 0;
     
-    float * df_temp = calloc(len, sizeof(float)); // for output
+    for (; j + FD_LANES <= n; j += FD_LANES)
+        for (int k = 0; k < FD_LANES; k++) acc[k] += x[j+k] * w[j+k];
+    for (int k = 0; j < n; j++, k++) acc[k] += x[j] * w[j]; // the partial block at the end
+    
+    for (int width = FD_LANES/2; width > 0; width /= 2)      // fixed pairwise tree over the lanes
+        for (int k = 0; k < width; k++) acc[k] += acc[k + width];
+    
+    return acc[0];
+}
+
+// ----
+// Fixed window kernels
+
+// When useNWeights (or the threshold) cuts the weights down to a short window of K weights, everything past
+// weights[K-1] is zero, so there is no need to multiply the rest of the series by zeros.
+// Most setups use one of a few window sizes, so for K = 16, 32, 64 and 128 there are kernels
+// with K built in:  the weights are copied into a local array the compiler can keep in registers,
+// the loop over the window is fully unrolled, and 8 outputs are done side by side so the compiler can
+// use SIMD across the outputs.  Each output is still summed one weight at a time in the same order
+// as the plain loop, so the results are identical to it.
+
+// number of weights actually in use:  the weights array is zero past the last weight the recurrence kept
+
+static int fdCountWeights(const float * weights, int length) {
+    int nw = length;
+    while (nw > 1 && weights[nw-1] == 0) nw--;
+    return nw;
+}
+
+#define FD_UNROLL _Pragma("GCC unroll 128")
+
+#define FD_DEFINE_FIXED_KERNEL(K) \
+FD_NO_FMA static void fdConvolveFixed##K(const float * series, int len, const float * weights, int from, int to, float * df_temp) { \
+    float w[K]; \
+    memcpy(w, weights, sizeof(w)); \
+    int i = from; \
+    int full = to < len - K + 1 ? to : len - K + 1; /* outputs before this have the whole window */ \
+    for (; i + 8 <= full; i += 8) { \
+        float sum[8] = {0}; \
+        FD_UNROLL \
+        for (int k = 0; k < K; k++) \
+            for (int lane = 0; lane < 8; lane++) sum[lane] += series[i+lane+k] * w[k]; \
+        memcpy(df_temp + i, sum, sizeof(sum)); \
+    } \
+    for (; i < full; i++) { \
+        float sum = 0; \
+        FD_UNROLL \
+        for (int k = 0; k < K; k++) sum += series[i+k] * w[k]; \
+        df_temp[i] = sum; \
+    } \
+    for (; i < to; i++) { /* the window runs off the end of the series */ \
+        float sum = 0; \
+        for (int j = i; j < len; j++) sum += series[j] * w[j-i]; \
+        df_temp[i] = sum; \
+    } \
+}
+
+FD_DEFINE_FIXED_KERNEL(16)
+FD_DEFINE_FIXED_KERNEL(32)
+FD_DEFINE_FIXED_KERNEL(64)
+FD_DEFINE_FIXED_KERNEL(128)
+
+// The main loops of fracDiff, done for outputs from .. to-1 only,
+// so that the threaded versions below can split the outputs up between threads
+// and still get the exact same sums as the single threaded version.
+// nw is the number of weights in use (see fdCountWeights), the window only goes that far back.
+
+FD_NO_FMA static void fdConvolveRangeKernel(const float * series, int len, const float * weights, int nw, int from, int to, float * df_temp) {
+    
+    if (atomic_load(&fdDeterministic)) {
+        for (int i = from; i < to; i++) df_temp[i] = fdDotFixed(series + i, weights, len - i < nw ? len - i : nw);
+        return;
+    }
+    
+    switch (nw) {
+        case 16:  fdConvolveFixed16(series, len, weights, from, to, df_temp);  return;
+        case 32:  fdConvolveFixed32(series, len, weights, from, to, df_temp);  return;
+        case 64:  fdConvolveFixed64(series, len, weights, from, to, df_temp);  return;
+        case 128: fdConvolveFixed128(series, len, weights, from, to, df_temp); return;
+    }
     
     // for every value in the original series
-    for (int i = 0; i < len; i++)
+    for (int i = from; i < to; i++)
     {
         // dot product of (orig array from i to the end) DOT (full weights array)
         // taking care not to roll past the end of either warray
         
          float sum = 0;
 
-        // go from the given item in the orig series to the end, multiply each
+        // go from the given item in the orig series to the end (or the end of the window), multiply each
         // of these values by a corresponding weight,
         // the sum up the result
         
-        for (int j = i; j < len; j++) {
+        int end = len - i < nw ? len : i + nw;
+        for (int j = i; j < end; j++) {
             sum += series[j] * weights[j-i];  // note that since j starts at i for this loop, we always start with weights[0]
         }
         df_temp[i] = sum;
     }
+}
+
+// the kernels with denormals flushed (see above), for whichever thread runs them
+
+static void fdConvolveRange(const float * series, int len, const float * weights, int nw, int from, int to, float * df_temp) {
+    fdFpMode saved = fdDenormalsOff();
+    fdConvolveRangeKernel(series, len, weights, nw, from, to, df_temp);
+    fdDenormalsRestore(saved);
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT ON
+#endif
+
+// sign of gamma(x):  positive for x > 0, alternating between the poles for x < 0
+
+static double fdGammaSign(double x) {
+    return x > 0 || fmod(floor(x), 2) == 0 ? 1 : -1;
+}
+
+// running sum of the weights w[0] + ... + w[tau], for any real tau >= 0 (see fracDiffIrregular below for where
+// the formula comes from):  S(tau) = gamma(tau + 1 - d) / (gamma(1 - d) * gamma(tau + 1))
+
+static double fdCumWeight(double d, double tau) {
+    
+    double a = 1 - d;
+    
+    if (a <= 0 && a == floor(a)) {
+        // d = 1, 2, ...:  (1-z)^(d-1) is a polynomial, and 1/gamma(1-d) is 0 except at the whole lags
+        if (tau != floor(tau) || tau > d - 1) return 0;
+        double c = 1;
+        for (int k = 1; k <= tau; k++) c = (-c*(d-1-k+1))/k; // recurrence [A] with d-1
+        return c;
+    }
+    
+    return fdGammaSign(tau + a) * fdGammaSign(a) * exp(lgamma(tau + a) - lgamma(a) - lgamma(tau + 1));
+}
+
+// Sum of the weights w[from] .. w[len-1] for d, i.e. the part of the full filter that a run with only the
+// first `from` weights leaves out:  S(len-1) - S(from-1), with the running sums S in closed form, so O(1) for any len.
+// For d > 0 the dropped weights are all negative, so this is minus the mass that went missing.
+
+double fdTailMass(float d, int from, int len) {
+    if (from < 1) from = 1;
+    if (from >= len) return 0;
+    return fdCumWeight(d, len - 1) - fdCumWeight(d, from - 1);
+}
+
+// weights left out by the last fracDiffInto() / fracDiff() call on this thread (threshold, useNWeights and
+// the subnormal cutoff together), as fdTailMass() of the weights it actually used
+
+// The call only records (d, number of weights used, len), the mass is worked out when asked for.
+
+typedef struct {
+    float d;
+    int nw, len;
+} fdDropInfo;
+
+static _Thread_local fdDropInfo fdLastDropped = {0, 0, 0};
+
+double fdDroppedMass(void) {
+    return fdTailMass(fdLastDropped.d, fdLastDropped.nw, fdLastDropped.len);
+}
+
+// work (multiply-adds) for outputs from .. to-1 of a series of length len with nw weights:
+// output i costs len-i, or nw once the window fits inside the series
+
+static double fdRangeWork(int len, int nw, int from, int to) {
+    int c = len - nw; // outputs before this have the whole window
+    double work = 0;
+    if (from < c) {
+        int e = to < c ? to : c;
+        work += (double)(e - from) * nw;
+        from = e;
+    }
+    if (from < to) work += 0.5 * ((double)(len - from) * (len - from + 1) - (double)(len - to) * (len - to + 1));
+    return work;
+}
+
+// ----
+// Integer d
+
+// For whole number d the weights are binomial coefficients:  d = 0 is the identity, d = 1 the ordinary difference
+// x[i] - x[i+1], d = 2 the second difference, and so on, with only d+1 nonzero weights.  Negative whole d is
+// repeated summation:  d = -1 is the cumulative sum (weights all 1), d = -2 the cumulative sum of that, ...
+
+// d >= 0:  the short filter is run directly, without generating (and allocating) len weights first.
+// d = 0 and d = 1 (or any 1 or 2 weight window) get their own loops, with the adds done in the same order as the
+// general loop (0 + x[i]*1 + x[i+1]*w[1]), so the results are the same bits as the general path.
+// d < 0 with full memory:  -d running (suffix) sums instead of the O(n^2) convolution, see fdSuffixScan below.
+// These are done in double, so they are more accurate than the general path, but NOT the same numbers:  the general
+// path adds up to len floats one at a time in float (a separate sum for each output), and on long series its rounding
+// error is visible well past the last bit (on 3000 values around 100, outputs differ by up to about 0.4 for d = -1
+// and several hundred for d = -2).  No O(n) scan can give those same float sums, so the scan is off by default and
+// whole d < 0 gets the same bits as any other d.  fdSetIntegerScan(1) turns it on; everything that gives fracDiff's
+// outputs (the threaded, panel, strided, lazy versions) then takes the same scan and gets the same bits as fracDiff.
+// Deterministic mode keeps its own fixed summation order, so only d = 0 and 1 (where the orders agree) are
+// taken out of it.  Returns 1 if done here, 0 to use the general path.
+
+static atomic_int fdIntegerScan = 0;
+
+void fdSetIntegerScan(int on) {
+    atomic_store(&fdIntegerScan, on != 0);
+}
+
+// number of summing passes if fracDiff(series, len, d, threshold, useNWeights) is done by the scan, 0 if not
+
+static int fdScanPasses(int len, float d, float threshold, int useNWeights) {
+    if (d != floorf(d) || d >= 0 || d < -64 || threshold >= 1 || len < 1) return 0;
+    if (!atomic_load(&fdIntegerScan) || atomic_load(&fdDeterministic) || (useNWeights > 0 && useNWeights < len)) return 0;
+    return (int)-d;
+}
+
+// The suffix sums are done in blocks of FD_SCAN_BLOCK values, counted from the old end of the series
+// (block k is outputs len-(k+1)*B .. len-k*B-1), in three steps per pass:
+// 1. the running sum within each block, from its old end, and the block's total
+// 2. the running sum of the block totals, which is what every block still has to add on from the blocks older than it
+// 3. that offset added onto the block
+// Steps 1 and 3 are independent from block to block, so the threaded version (fracDiffParallel) spreads them over the
+// pool, and step 3 is a plain add the compiler can vectorize.  The adds are the same whoever does which block, and
+// since the blocks are lined up with the old end, the outputs of series + from are the same bits as outputs from ..
+// of the whole series (which is how the strided, indices and lazy versions use it).
+
+#define FD_SCAN_BLOCK 4096
+
+static int fdScanBlockCount(int len) {
+    return (len + FD_SCAN_BLOCK - 1) / FD_SCAN_BLOCK;
+}
+
+// step 1 for blocks k0 .. k1-1
+
+static void fdScanBlocks(double * acc, int len, int k0, int k1, double * totals) {
+    for (int k = k0; k < k1; k++) {
+        int hi = len - k * FD_SCAN_BLOCK;
+        int lo = hi - FD_SCAN_BLOCK > 0 ? hi - FD_SCAN_BLOCK : 0;
+        for (int i = hi - 2; i >= lo; i--) acc[i] += acc[i+1];
+        totals[k] = acc[lo];
+    }
+}
+
+// step 2:  totals in, offsets out (in place)
+
+static void fdScanOffsets(double * totals, int nBlocks) {
+    double offset = 0;
+    for (int k = 0; k < nBlocks; k++) {
+        double total = totals[k];
+        totals[k] = offset;
+        offset += total;
+    }
+}
+
+// step 3 for blocks k0 .. k1-1, and on the last pass the floats out as well
+
+static void fdScanAdd(double * acc, int len, int k0, int k1, const double * offsets, float * out) {
+    for (int k = k0; k < k1; k++) {
+        int hi = len - k * FD_SCAN_BLOCK;
+        int lo = hi - FD_SCAN_BLOCK > 0 ? hi - FD_SCAN_BLOCK : 0;
+        double offset = offsets[k];
+        for (int i = lo; i < hi; i++) acc[i] += offset;
+        if (out) for (int i = lo; i < hi; i++) out[i] = (float)acc[i];
+    }
+}
+
+// passes running sums of series[0 .. len-1] into out (out may be the series), on this thread
+
+static void fdSuffixScan(const float * series, int len, int passes, float * out) {
+    int nBlocks = fdScanBlockCount(len);
+    double * acc = malloc(len * sizeof(double));
+    double * totals = malloc(nBlocks * sizeof(double));
+    for (int i = 0; i < len; i++) acc[i] = series[i];
+    for (int pass = 0; pass < passes; pass++) {
+        fdScanBlocks(acc, len, 0, nBlocks, totals);
+        fdScanOffsets(totals, nBlocks);
+        fdScanAdd(acc, len, 0, nBlocks, totals, pass == passes - 1 ? out : NULL);
+    }
+    free(acc);
+    free(totals);
+}
+
+FD_NO_FMA static int fdIntegerD(const float * series, int len, float d, float threshold, int useNWeights, float * df_temp) {
+    
+    if (d != floorf(d) || fabsf(d) > 64 || threshold >= 1 || len < 1) return 0; // all the weights are >= 1 in size
+    int m = (int)d;
+    int deterministic = atomic_load(&fdDeterministic);
+    fdFpMode saved;
+    
+    if (m < 0) {
+        int passes = fdScanPasses(len, d, threshold, useNWeights);
+        if (!passes) return 0;
+        fdSuffixScan(series, len, passes, df_temp);
+        fdLastDropped = (fdDropInfo){d, len, len};
+        return 1;
+    }
+    
+    int nw = m + 1;
+    if (useNWeights > 0 && useNWeights < nw) nw = useNWeights;
+    if (nw > len) nw = len;
+    if (deterministic && nw > 2) return 0;
+    
+    float w[65] = {1};
+    for (int k = 1; k < nw; k++) w[k] = (-w[k-1]*(d-k+1))/k; // recurrence [A], the same floats findWeights_ffd() makes
+    
+    saved = fdDenormalsOff(); // same flushing as the general kernels
+    if (nw == 1) {
+        for (int i = 0; i < len; i++) df_temp[i] = 0.0f + series[i];
+    } else if (nw == 2) {
+        float w1 = w[1];
+        for (int i = 0; i < len - 1; i++) df_temp[i] = (0.0f + series[i]) + series[i+1] * w1;
+        df_temp[len-1] = 0.0f + series[len-1];
+    } else {
+        fdConvolveRangeKernel(series, len, w, nw, 0, len, df_temp);
+    }
+    fdDenormalsRestore(saved);
+    
+    fdLastDropped = (fdDropInfo){d, nw, len};
+    return 1;
+}
+
+// ----
+// General FIR filtering
+
+// As the notes at the top say, fractional differencing is just discrete time filtering with a particular
+// set of weights.  applyFilter() is the same engine with any weights:  out[i] = sum over k of weights[k] * series[i+k]
+// (most recent value first, the same layout and the same running-out-of-data edge as fracDiff).
+// It goes through the same kernels as fracDiff (the fixed window kernels for K = 16/32/64/128, deterministic mode,
+// denormal flushing), so EMA-like, tapered or custom kernels run as fast as fracDiff does.
+// The other backends have the same form:  applyFilterParallel() splits the outputs over the thread pool,
+// applyFilterFFT() does it by FFT in O(n log n) for long filters.
+// out may be the series array itself.  Trailing zero weights are skipped.
+
+void applyFilter(const float * series, int len, const float * weights, int K, float * out) {
+    if (len <= 0 || K <= 0) return;
+    int nw = fdCountWeights(weights, K < len ? K : len);
+    fdConvolveRange(series, len, weights, nw, 0, len, out);
+}
+
+// fracDiffInto() is the same as fracDiff() below, but writes the len outputs into the caller's df_temp array
+// instead of allocating one.  df_temp may be the series array itself (output i only depends on the series
+// from i onwards, which has not been overwritten yet when output i is written).
+
+void fracDiffInto(const float * series, int len, float d, float threshold, int useNWeights, float * df_temp) {
+    
+    if (fdIntegerD(series, len, d, threshold, useNWeights, df_temp)) return; // O(n) for whole number d
+    
+    // windows of one of the tabled d values use the compile time weights, as long as the threshold
+    // wouldn't have cut any of them off
+    const float * table = findWeights_ffd_const(d, useNWeights);
+    for (int k = 0; table && k < useNWeights; k++)
+        if (fabsf(table[k]) <= threshold) table = NULL;
+    if (table) {
+        applyFilter(series, len, table, useNWeights, df_temp);
+        fdLastDropped = (fdDropInfo){d, useNWeights, len};
+        return;
+    }
+    
+    float * weights = findWeights_ffd(d, len, threshold, useNWeights); // generate the weights
+    
+    int nw = fdCountWeights(weights, len);
+    
+    applyFilter(series, len, weights, nw, df_temp);
+    fdLastDropped = (fdDropInfo){d, nw, len};
     
     // Theoretical papers often leave out important points such as this:
     
@@ -246,101 +883,3575 @@ float * fracDiff(float * series, int len, float d, float threshold, int useNWeig
     // beyond it to difference with.
     
     free(weights);
+}
+
+float * fracDiff(float * series, int len, float d, float threshold, int useNWeights) {
+    
+    float * df_temp = calloc(len, sizeof(float)); // for output
+    
+    fracDiffInto(series, len, d, threshold, useNWeights, df_temp);
                    
     return df_temp;
 
 }
 
-// main program to test the algorithm w/ some default data
+// ----
+// Only some of the outputs
 
-int main(int argc, const char * argv[]) {
-    
-        // test the weight generation routine
-        
-        int len = 10;
+// Live jobs often only need the latest few outputs, or every 5th one.  Output i is a dot product over the series from i
+// on, independent of the other outputs, so these only do the dot products asked for.  Output i of the series
+// is output 0 of the series starting at i, which is how each one is run through the usual kernels (so the values are the
+// same bits as the matching fracDiff() outputs).  And output i needs only len-i weights, so the weights are only
+// generated out to len - (smallest index asked for).  The latest value with full memory is O(n) this way, not O(n^2).
 
-        // the "series" array is the time series we will difference
+// weights for outputs from minIndex on (findWeights_ffd() makes the same values, just fewer of them)
 
-        // if this is considered a price time series, the most recent price is first
-        // and the oldest price is last
+static float * fdWeightsFrom(float d, int len, float threshold, int useNWeights, int minIndex, int * nw) {
+    int n = len - minIndex;
+    float * weights = findWeights_ffd(d, n, threshold, useNWeights);
+    *nw = fdCountWeights(weights, n);
+    return weights;
+}
+
+// out[k] = output from + k*stride of fracDiff(series, len, d, threshold, useNWeights), for from + k*stride < to.
+// e.g. the latest N values:  fracDiffStrided(series, len, d, 0, 0, 0, N, 1, out)
+// Returns the number of outputs written.
+
+int fracDiffStrided(const float * series, int len, float d, float threshold, int useNWeights, int from, int to, int stride, float * out) {
     
-        // so for this example, an ordinary difference of the first value - the value
-        // immediately previous in time is:  series[0]-series[1] = 2-1 = 1
+    if (from < 0) from = 0;
+    if (to > len) to = len;
+    if (stride < 1 || from >= to) return 0;
     
-        // if you add or delete values from this array, don't forget to change the variable len above correspondingly
+    int passes = fdScanPasses(len, d, threshold, useNWeights);
+    if (passes) {
+        // negative whole d:  the scan of the series from `from` on, O(n) (see fdSuffixScan)
+        float * all = malloc((len - from) * sizeof(float));
+        fdSuffixScan(series + from, len - from, passes, all);
+        int count = 0;
+        for (int i = from; i < to; i += stride) out[count++] = all[i - from];
+        free(all);
+        return count;
+    }
     
-        float series[] = {2, 1, 3, 5, 6,   0, -1, 2, 2, 5};
-
-        float tolerance = 0; // just use all weights for now, don't set a cutoff tolerance
+    int nw;
+    float * weights = fdWeightsFrom(d, len, threshold, useNWeights, from, &nw);
+    int count = 0;
     
-        int useNWeights = 0; // if useNWeights != 0, the operation isn't revers
+    if (stride == 1) {
+        fdConvolveRange(series + from, len - from, weights, nw, 0, to - from, out); // a block, so the kernels can vectorize
+        count = to - from;
+    } else {
+        fdFpMode saved = fdDenormalsOff(); // once for the whole loop, not per output
+        for (int i = from; i < to; i += stride, count++)
+            fdConvolveRangeKernel(series + i, len - i, weights, len - i < nw ? len - i : nw, 0, 1, out + count);
+        fdDenormalsRestore(saved);
+    }
     
-        // difflevel notes:
+    free(weights);
+    return count;
+}
+
+// out[k] = output indices[k] of fracDiff(series, len, d, threshold, useNWeights), for any list of indices (0 .. len-1)
+
+void fracDiffIndices(const float * series, int len, float d, float threshold, int useNWeights, const int * indices, int nIndices, float * out) {
     
-        // if we set this to 1, fd (fractional difference) series becomes the ordinary day to day difference
+    if (nIndices <= 0) return;
+    int minIndex = len;
+    for (int k = 0; k < nIndices; k++) if (indices[k] < minIndex) minIndex = indices[k];
+    if (minIndex < 0) minIndex = 0;
+    if (minIndex >= len) return;
     
-        // if we set this to -1, the result is an ordinary definite integral (cumulative sum, assuming time deltas of 1)
-        // for the case of -1 (ordinary definite integral):
-        // first value of the resulting array should match the full sum of the above series (computed below for reference).
-        // e.g. array element 0 to the end of the array (index len-1)
+    int passes = fdScanPasses(len, d, threshold, useNWeights);
+    if (passes) {
+        float * all = malloc((len - minIndex) * sizeof(float));
+        fdSuffixScan(series + minIndex, len - minIndex, passes, all);
+        for (int k = 0; k < nIndices; k++)
+            if (indices[k] >= 0 && indices[k] < len) out[k] = all[indices[k] - minIndex];
+        free(all);
+        return;
+    }
     
-        // the second value of the resulting array should match the sum of the series from array element [1] (2nd element since we are
-        // in C code with 0-indexed arrays) to the end of the series
+    int nw;
+    float * weights = fdWeightsFrom(d, len, threshold, useNWeights, minIndex, &nw);
     
-        // and so on
+    fdFpMode saved = fdDenormalsOff();
+    for (int k = 0; k < nIndices; k++) {
+        int i = indices[k];
+        if (i < 0 || i >= len) continue;
+        fdConvolveRangeKernel(series + i, len - i, weights, len - i < nw ? len - i : nw, 0, 1, out + k);
+    }
+    fdDenormalsRestore(saved);
     
-        // interesting experiment to try:
-        // set difflevel close to 0 (e.g. 0.01), you get a slightly modified version of your orig series
-        // a very mild high-pass filter
+    free(weights);
+}
+
+// ----
+// Lazy, memoizing view of a fracDiff output series
+
+// For code that reads fracDiff outputs here and there, in no particular order:  nothing is computed up front,
+// reading output i computes the block of FD_LAZY_BLOCK outputs around it (as one vectorized fracDiffStrided() style block)
+// and keeps it, so reading it or its neighbours again is just a lookup.  Only blocks that are actually read get computed.
+// The kept blocks are limited to maxBytes of memory (at least one block), and when a new block would go over,
+// the least recently used one is dropped (and recomputed if it is read again).  maxBytes only counts those output
+// blocks:  the weights (up to len floats, made once, see below) and the view's bookkeeping come on top of it.
+// The values are the same bits as fracDiff()'s.
+// The weights are generated once when the view is made (for negative whole d with the scan on, see fdSetIntegerScan,
+// a block is the scan from its start to the old end instead, and no weights are needed).
+// The series must stay valid for the life of the view.
+// A view is not thread safe; give each thread its own.
+
+#define FD_LAZY_BLOCK 256
+
+typedef struct {
+    const float * series;
+    int len;
+    float * weights;
+    int nw;
+    int passes;                 // > 0:  negative whole d, blocks come from the scan
+    int nBlocks;
+    float ** blocks;            // NULL = not computed (or dropped)
+    unsigned long long * used;  // last use of each block, for the LRU
+    unsigned long long clock;
+    int maxBlocks;
+    int nCached;
+} fdLazyView;
+
+fdLazyView * fdLazyCreate(const float * series, int len, float d, float threshold, int useNWeights, size_t maxBytes) {
     
-        float difflevel = 0.5;
+    fdLazyView * v = calloc(1, sizeof(fdLazyView));
+    v->series = series;
+    v->len = len;
+    v->passes = fdScanPasses(len, d, threshold, useNWeights);
+    if (len > 0 && !v->passes) v->weights = fdWeightsFrom(d, len, threshold, useNWeights, 0, &v->nw);
+    v->nBlocks = (len + FD_LAZY_BLOCK - 1) / FD_LAZY_BLOCK;
+    v->blocks = calloc(v->nBlocks > 0 ? v->nBlocks : 1, sizeof(float *));
+    v->used = calloc(v->nBlocks > 0 ? v->nBlocks : 1, sizeof(unsigned long long));
+    size_t maxBlocks = maxBytes / (FD_LAZY_BLOCK * sizeof(float));
+    v->maxBlocks = maxBlocks < 1 ? 1 : maxBlocks > (size_t)v->nBlocks ? v->nBlocks : (int)maxBlocks;
+    return v;
+}
+
+void fdLazyDestroy(fdLazyView * v) {
+    if (!v) return;
+    for (int b = 0; b < v->nBlocks; b++) free(v->blocks[b]);
+    free(v->blocks);
+    free(v->used);
+    free(v->weights);
+    free(v);
+}
+
+// output i (0 .. len-1) of the fracDiff this view stands for; NaN for an i outside that range
+
+float fdLazyGet(fdLazyView * v, int i) {
     
-        // for ref:  sum of orig series (integral with delta t = 1)
+    if (i < 0 || i >= v->len) return NAN;
     
-        float sumseries = 0;
-        for (int i = 0; i < len; i++) sumseries += series[i];
+    int b = i / FD_LAZY_BLOCK;
     
-        printf("sum of orig series = %f\n", sumseries);
+    if (!v->blocks[b]) {
+        float * block;
+        if (v->nCached >= v->maxBlocks) {
+            int lru = -1;  // drop the least recently used block, and reuse its memory
+            for (int k = 0; k < v->nBlocks; k++)
+                if (v->blocks[k] && (lru < 0 || v->used[k] < v->used[lru])) lru = k;
+            block = v->blocks[lru];
+            v->blocks[lru] = NULL;
+            v->nCached--;
+        } else {
+            block = malloc(FD_LAZY_BLOCK * sizeof(float));
+        }
+        int from = b * FD_LAZY_BLOCK;
+        int to = from + FD_LAZY_BLOCK < v->len ? from + FD_LAZY_BLOCK : v->len;
+        if (v->passes) {
+            float * all = malloc((v->len - from) * sizeof(float));
+            fdSuffixScan(v->series + from, v->len - from, v->passes, all);
+            memcpy(block, all, (to - from) * sizeof(float));
+            free(all);
+        } else {
+            fdConvolveRange(v->series + from, v->len - from, v->weights, v->nw, 0, to - from, block);
+        }
+        v->blocks[b] = block;
+        v->nCached++;
+    }
     
-        float * w = findWeights_ffd(difflevel, len, tolerance, useNWeights);
+    v->used[b] = ++v->clock;
+    return v->blocks[b][i - b * FD_LAZY_BLOCK];
+}
+
+// ----
+// Boundary modes
+
+// At the old end of the series fracDiff runs out of data (see the TLDR note in fracDiff):  the last K-1 outputs
+// of a K weight window only get part of the weighted sum, and the very last one is the input itself.
+// Often those outputs are thrown away anyway, or something else is wanted there:
+// FD_BOUNDARY_FULL          as fracDiff, len outputs, cut off sums at the end
+// FD_BOUNDARY_VALID         only outputs with the whole window inside the series:  len-K+1 of them, and the work
+//                           for the others is never done (a big saving for wide windows on short series)
+// FD_BOUNDARY_PAD_CONSTANT  len outputs, as if the series went on past its end with padValue
+//                           (done as the cut off sums plus padValue times the left out weights, no extra work)
+// FD_BOUNDARY_PAD_MIRROR    len outputs, as if the series went on past its end mirrored back on itself
+//                           (x[len], x[len+1], ... = x[len-2], x[len-3], ...)
+// With full memory the window is the whole series, so VALID gives just output 0.
+// The VALID and FULL outputs are the same bits as fracDiff()'s.
+
+#define FD_BOUNDARY_FULL 0
+#define FD_BOUNDARY_VALID 1
+#define FD_BOUNDARY_PAD_CONSTANT 2
+#define FD_BOUNDARY_PAD_MIRROR 3
+
+// Returns a calloc'd array the caller must free(), with the number of outputs in *outLen.
+
+float * fracDiffBoundary(float * series, int len, float d, float threshold, int useNWeights, int mode, float padValue, int * outLen) {
     
-        // sum the weights to see what they look like in aggregate.
-        // this is just for exploration purposes.  do they sum to something
-        // interesting like 0, 1, or -1?
+    *outLen = 0;
+    if (len <= 0) return calloc(1, sizeof(float));
     
-        float sum = 0;
-        for (int i = 0; i < len; i++) {
-            printf("w[%d] = %f\n", i, w[i]);
-            sum += w[i];
+    int nw;
+    float * weights = fdWeightsFrom(d, len, threshold, useNWeights, 0, &nw);
+    int n = mode == FD_BOUNDARY_VALID ? len - nw + 1 : len;
+    float * out = calloc(n, sizeof(float));
+    
+    if (mode == FD_BOUNDARY_PAD_MIRROR && len > 1) {
+        // the series with nw-1 mirrored values after its end (folding back and forth if the window is longer than the series)
+        int period = 2 * (len - 1);
+        float * ext = malloc((len + nw - 1) * sizeof(float));
+        for (int j = 0; j < len + nw - 1; j++) {
+            int m = j % period;
+            ext[j] = series[m < len ? m : period - m];
         }
-        
-        printf("sum of wts = %f\n", sum);
-        
-        free(w);
-        
-        // test the fractional differencing on above defined series
+        fdConvolveRange(ext, len + nw - 1, weights, nw, 0, len, out);
+        free(ext);
+    } else if (fdScanPasses(len, d, threshold, useNWeights)) {
+        // negative whole d, as fracDiff does it
+        float * all = n == len ? out : malloc(len * sizeof(float));
+        fdSuffixScan(series, len, fdScanPasses(len, d, threshold, useNWeights), all);
+        if (all != out) {
+            memcpy(out, all, n * sizeof(float));
+            free(all);
+        }
+    } else {
+        fdConvolveRange(series, len, weights, nw, 0, n, out);
+    }
     
-        // fd = fractional difference
+    if (mode == FD_BOUNDARY_PAD_CONSTANT && padValue != 0) {
+        // output i is missing weights len-i .. nw-1, whose sum is the total minus the running sum up to len-i-1
+        double * cum = malloc(nw * sizeof(double));
+        double c = 0;
+        for (int k = 0; k < nw; k++) cum[k] = c += weights[k];
+        for (int i = len - nw + 1; i < len; i++) out[i] += (float)(padValue * (cum[nw-1] - cum[len-i-1]));
+        free(cum);
+    }
     
-        float * fd = fracDiff(series, len, difflevel, tolerance, useNWeights);
-        
-        // dump out results, compare to orig
-        
-        for (int i = 0; i < len; i++)
-            printf("orig = %f fd = %f\n", series[i], fd[i]);
-        
-        // re-integrate the differenced series by using -difflevel,
-        // should get orig result back maybe w/ a little numeric noise
+    free(weights);
+    *outLen = n;
+    return out;
+}
+
+// ----
+// Patching the output after revisions to old data
+
+// When a vendor corrects an old value series[j], only the outputs that use it change:  outputs j-K+1 .. j for a
+// K weight window (outputs j and newer, back to the window length).  Output i uses series[j] with weight w[j-i],
+// so the fix is just out[i] += w[j-i] * (new value - old value), for those outputs only.
+// The cost is the window length (or j+1 with full memory) per revision, instead of the O(n^2) full rerun.
+// Revisions are applied in order (a repeated index just gets patched twice), and series[] is updated as well,
+// so the series and output stay in step for the next batch of revisions.
+// The patched outputs match a full rerun up to float rounding, not bit for bit (the sums are done in a different order).
+
+void fracDiffRevise(float * series, int len, float d, float threshold, int useNWeights, float * df,
+                    const int * indices, const float * newValues, int nRevisions) {
     
-        // fi = fractional integral
+    int maxIndex = -1;
+    for (int r = 0; r < nRevisions; r++)
+        if (indices[r] >= 0 && indices[r] < len && indices[r] > maxIndex) maxIndex = indices[r];
+    if (maxIndex < 0) return;
     
-        float * fi = fracDiff(fd, len, -difflevel, tolerance, useNWeights);
-        
-        for (int i = 0; i < len; i++)
-            printf("redo orig = %f fi = %f\n", series[i], fi[i]);
-        
-        free(fd);
-        free(fi);
+    // a revision at j needs weights up to lag j (or the end of the window), the same values fracDiff used
+    float * weights = findWeights_ffd(d, maxIndex + 1, threshold, useNWeights);
+    int nw = fdCountWeights(weights, maxIndex + 1);
     
-        return 0;
+    for (int r = 0; r < nRevisions; r++) {
+        int j = indices[r];
+        if (j < 0 || j >= len) continue;
+        float delta = newValues[r] - series[j];
+        series[j] = newValues[r];
+        for (int i = j - nw + 1 > 0 ? j - nw + 1 : 0; i <= j; i++) df[i] += weights[j-i] * delta;
+    }
+    
+    free(weights);
+}
+
+// ----
+// Spectral (frequency domain) fractional differencing
+
+// The notes at the top of this file discuss the fractional difference as a filter
+// in the frequency domain.  Here we actually use that view to compute it:
+// multiply the transform of the (zero padded) series by the transform of the filter,
+// then transform back.  The convolution in fracDiff() is O(n^2), while this is O(n log n),
+// which matters a lot once series get to be hundreds of thousands of points or more.
+
+// This is a plain iterative radix-2 FFT done in double precision (n must be a power of 2).
+// The double precision keeps the round-off of the transforms well below float resolution,
+// so the output matches fracDiff() to about float precision.
+// inverse = 0 for forward transform, 1 for inverse (the inverse is not scaled by 1/n here).
+
+static void fdFFT(double * re, double * im, int n, int inverse) {
+    
+    // bit reversal permutation
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    
+    // twiddle factors for the largest stage, the smaller stages just stride through this table
+    double * c = malloc((n/2 + 1) * sizeof(double));
+    double * s = malloc((n/2 + 1) * sizeof(double));
+    double sign = inverse ? 1 : -1;
+    for (int k = 0; k < n/2; k++) {
+        c[k] = cos(2*M_PI*k/n);
+        s[k] = sign*sin(2*M_PI*k/n);
+    }
+    
+    for (int size = 2; size <= n; size <<= 1) {
+        int half = size >> 1;
+        int step = n / size;
+        for (int i = 0; i < n; i += size) {
+            for (int j = 0; j < half; j++) {
+                double wr = c[j*step], wi = s[j*step];
+                int a = i + j, b = i + j + half;
+                double tr = re[b]*wr - im[b]*wi;
+                double ti = re[b]*wi + im[b]*wr;
+                re[b] = re[a] - tr; im[b] = im[a] - ti;
+                re[a] += tr;        im[a] += ti;
+            }
+        }
+    }
+    
+    free(c);
+    free(s);
+}
+
+static int fdNextPow2(int n) {
+    int p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+// Product of two real polynomials by FFT, in the caller's buffers:  a in re[], b in im[], both zero padded out to n
+// (a power of 2, at least the length of the product).  A single forward FFT transforms both of them, and on return
+// re[t] / n is coefficient t of the product (im is scratch).
+
+static void fdPolyMulInto(double * re, double * im, int n) {
+    
+    fdFFT(re, im, n, 0);
+    
+    // unpack the two spectra A and B from Z = FFT(a + jb) and multiply them:
+    // A[k] = (Z[k] + conj(Z[n-k]))/2,  B[k] = (Z[k] - conj(Z[n-k]))/2j
+    for (int k = 0; k <= n/2; k++) {
+        int m = (n - k) & (n - 1);
+        double ar = re[k], ai = im[k], br = re[m], bi = -im[m]; // Z[k], conj(Z[n-k])
+        double xr = (ar + br)/2, xi = (ai + bi)/2;
+        double wr = (ai - bi)/2, wi = -(ar - br)/2;
+        double pr = xr*wr - xi*wi, pi = xr*wi + xi*wr;          // product at k
+        // and the product at n-k is its complex conjugate (both inputs are real)
+        re[k] = pr; im[k] = pi;
+        re[m] = pr; im[m] = -pi;
+    }
+    
+    fdFFT(re, im, n, 1);
+}
+
+// out[0..nOut-1] = first nOut coefficients of the product of polynomials a and b, by FFT (out may be a or b)
+
+static void fdPolyMul(const double * a, int na, const double * b, int nb, double * out, int nOut) {
+    
+    int n = fdNextPow2(na + nb - 1);
+    double * re = calloc(n, sizeof(double));
+    double * im = calloc(n, sizeof(double));
+    memcpy(re, a, na * sizeof(double));
+    memcpy(im, b, nb * sizeof(double));
+    
+    fdPolyMulInto(re, im, n);
+    
+    for (int t = 0; t < nOut; t++) out[t] = t < n ? re[t]/n : 0;
+    
+    free(re);
+    free(im);
+}
+
+// Why not just multiply by the analytic frequency response (1 - e^(-jw))^d = (2 sin(w/2))^d * e^(j d (pi - w) / 2)?
+// That is the response of the infinitely long filter.  fracDiff() runs out of data at the end of the
+// series (see the TLDR note in fracDiff), so it effectively uses a truncated weight set, and the
+// analytic response sampled on an FFT grid aliases the infinite weight tail back into the result
+// (and blows up at w = 0 when d < 0, integration has infinite gain at DC).  So fracDiffSpectral() below
+// transforms the exact truncated weights instead.
+
+// Same as fracDiff(series, len, d, 0, 0) (full memory, all weights, same finite-history edge),
+// but done by FFT in O(n log n).  Returns a calloc'd array the caller must free().
+
+// Layout:  this library stores the most recent value first, so the series is reversed into
+// ordinary time order (oldest first) and then the fractional difference is a causal convolution
+// y[t] = sum over k = 0..t of w[k] * x[t-k]
+// Zero padding to at least 2*len - 1 keeps the circular FFT convolution from wrapping around,
+// and the zero padding is exactly the "ran out of data" edge that fracDiff has.
+
+// The weights are never stored as an array of their own:  the recurrence [A] is run in double precision straight
+// into the imaginary part of the FFT buffer, next to the series in the real part, and fdPolyMulInto() does the
+// convolution in place (series and weights transformed together in one FFT).  So the only memory besides the output
+// is the two zero padded FFT buffers.
+
+float * fracDiffSpectral(float * series, int len, float d) {
+    
+    float * df_temp = calloc(len, sizeof(float)); // for output
+    if (len <= 0) return df_temp;
+    
+    int n = fdNextPow2(2*len - 1);
+    double * re = calloc(n, sizeof(double));
+    double * im = calloc(n, sizeof(double));
+    
+    double w_curr = 1;
+    for (int t = 0; t < len; t++) {
+        if (t > 0) w_curr = (-w_curr*(d-t+1))/t; // recurrence [A] in double
+        re[t] = series[len-1-t];                // series in time order
+        im[t] = w_curr;                         // weights
+    }
+    
+    fdPolyMulInto(re, im, n);
+    
+    for (int t = 0; t < len; t++) df_temp[len-1-t] = re[t]/n;
+    
+    free(re);
+    free(im);
+    
+    return df_temp;
+}
+
+// ----
+// Exact inverse of a (possibly truncated) fracDiff
+
+// As noted in main(), fracDiff with -d only undoes fracDiff with d when both use all the weights.  Once
+// the threshold or useNWeights cuts the weights off, the -d weights are no longer the inverse of the d weights
+// and the round trip drifts.  But whatever weights w were used, the forward step is a lower triangular
+// Toeplitz system (in time order, oldest first):
+// y[t] = w[0]*x[t] + w[1]*x[t-1] + ... + w[K-1]*x[t-K+1]   (terms before the start of the series left out)
+// and w[0] = 1, so it can be solved for x one value at a time, oldest first, in O(n K):
+// x[t] = (y[t] - w[1]*x[t-1] - ... - w[K-1]*x[t-K+1]) / w[0]
+// This is exact (up to rounding) for any weights, not just fractional difference ones.
+
+// For long windows (K in the thousands, or full memory) that is O(n^2) again, so instead the inverse filter
+// is computed as a power series:  with W(z) = w[0] + w[1] z + ... the forward step is Y = W X (mod z^n), so
+// X = V Y (mod z^n) with V = 1/W (mod z^n).  V comes from Newton's iteration V <- V (2 - W V), which doubles the
+// number of correct coefficients each step, with the products done by FFT:  O(n log n) overall.
+// For untruncated weights V is just the -d weights, but this way it is the exact inverse of the float weights
+// actually used (with their rounding, subnormal cutoff, ...).
+
+// below this many weights the direct solve is faster than the FFT route
+#define FD_INVERT_FFT_MIN_WEIGHTS 256
+
+// applyFilter() by FFT:  in time order the filter is a product of polynomials, series times weights,
+// of which the first len coefficients are the outputs.  Same results to about float precision, O(n log n),
+// so worth it once K is in the hundreds or more.  out may be the series array.
+
+void applyFilterFFT(const float * series, int len, const float * weights, int K, float * out) {
+    
+    if (len <= 0 || K <= 0) return;
+    if (K > len) K = len;
+    
+    int n = fdNextPow2(len + K - 1);
+    double * re = calloc(n, sizeof(double));
+    double * im = calloc(n, sizeof(double));
+    for (int t = 0; t < len; t++) re[t] = series[len-1-t];
+    for (int k = 0; k < K; k++) im[k] = weights[k];
+    
+    fdPolyMulInto(re, im, n);
+    for (int t = 0; t < len; t++) out[len-1-t] = (float)(re[t]/n);
+    
+    free(re);
+    free(im);
+}
+
+// first n coefficients of 1/W, for W with nw coefficients (w[0] != 0), by Newton's iteration
+
+static double * fdPowerSeriesInverse(const double * w, int nw, int n) {
+    
+    double * v = calloc(n, sizeof(double));
+    double * e = malloc(n * sizeof(double));
+    v[0] = 1 / w[0];
+    
+    for (int m = 1; m < n; m *= 2) {
+        int m2 = 2*m < n ? 2*m : n;
+        fdPolyMul(w, nw < m2 ? nw : m2, v, m, e, m2);   // e = W V (mod z^m2), = 1 + O(z^m)
+        for (int k = 0; k < m2; k++) e[k] = -e[k];
+        e[0] += 2;                                      // e = 2 - W V
+        fdPolyMul(v, m, e, m2, e, m2);                  // V (2 - W V)
+        memcpy(v, e, m2 * sizeof(double));
+    }
+    
+    free(e);
+    return v;
+}
+
+// Recover the series from df = the output of fracDiff (or any filter of this form) with weights[0..nw-1].
+// series_out may be df itself.
+
+void fracDiffInvertWeights(const float * df, int len, const float * weights, int nw, float * series_out) {
+    
+    if (len <= 0) return;
+    if (nw > len) nw = len;
+    
+    // time order (oldest first) double copies
+    double * y = malloc(len * sizeof(double));
+    double * w = malloc(nw * sizeof(double));
+    for (int t = 0; t < len; t++) y[t] = df[len-1-t];
+    for (int k = 0; k < nw; k++) w[k] = weights[k];
+    
+    if (nw < FD_INVERT_FFT_MIN_WEIGHTS) {
+        // y is overwritten with x as it goes:  x[t] only needs the x's before it
+        for (int t = 0; t < len; t++) {
+            double sum = y[t];
+            int kEnd = t + 1 < nw ? t + 1 : nw;
+            for (int k = 1; k < kEnd; k++) sum -= w[k] * y[t-k];
+            y[t] = sum / w[0];
+        }
+    } else {
+        double * v = fdPowerSeriesInverse(w, nw, len);
+        fdPolyMul(v, len, y, len, y, len);
+        free(v);
+    }
+    
+    for (int t = 0; t < len; t++) series_out[len-1-t] = (float)y[t];
+    
+    free(y);
+    free(w);
+}
+
+// Inverse of fracDiff(series, len, d, threshold, useNWeights):  regenerates the same weights and solves for the series.
+// Returns a calloc'd array the caller must free().
+
+float * fracDiffInvert(float * df, int len, float d, float threshold, int useNWeights) {
+    
+    float * series = calloc(len, sizeof(float));
+    if (len <= 0) return series;
+    
+    float * weights = findWeights_ffd(d, len, threshold, useNWeights);
+    fracDiffInvertWeights(df, len, weights, fdCountWeights(weights, len), series);
+    free(weights);
+    
+    return series;
+}
+
+// ----
+// Turning forecasts on the differenced scale back into levels
+
+// A model forecasts h steps ahead on the fractionally differenced scale, and the forecasts have to be integrated back
+// to levels.  The direct way appends them to the differenced history and runs the inverse over the whole
+// longer array, O(n^2) per forecast.  But with V the inverse filter (the -d weights, or the exact inverse of a
+// truncated filter, see fracDiffInvert above), the level s+1 steps ahead is
+// level[s] = sum over j of V[s+1+j] * df[j]  +  sum over q = 0..s of V[q] * forecast[s-q]
+// (df most recent first, as fracDiff returns it).  The first part only depends on the history, so it is worked out once
+// when the inverter is made, O(h n), and then each set of forecasts only costs the short second part, O(h^2).
+
+// Forecasts and levels are in step order:  forecast[0] / levels[0] is the next step, [1] the one after, ...
+// (not most recent first like the series, since there is no natural "end" to a forecast).
+
+typedef struct {
+    int horizon;
+    double * v;        // inverse filter, V[0 .. horizon-1]
+    double * history;  // the history part of each level, history[0 .. horizon-1]
+} fdForecastInverter;
+
+// df = fracDiff(series, len, d, threshold, useNWeights) of the level history, most recent first
+
+fdForecastInverter * fdForecastInverterCreate(const float * df, int len, float d, float threshold, int useNWeights, int horizon) {
+    
+    fdForecastInverter * inv = calloc(1, sizeof(fdForecastInverter));
+    if (horizon < 1) horizon = 1;
+    inv->horizon = horizon;
+    inv->history = calloc(horizon, sizeof(double));
+    int n = len + horizon; // V out to lag len + horizon - 1
+    
+    double * v;
+    if (threshold <= 0 && (useNWeights <= 0 || useNWeights >= n)) {
+        // all the weights:  V is the -d weights, recurrence [A] in double
+        v = malloc(n * sizeof(double));
+        v[0] = 1;
+        for (int k = 1; k < n; k++) v[k] = (-v[k-1]*(-(double)d-k+1))/k;
+    } else {
+        float * weights = findWeights_ffd(d, n, threshold, useNWeights);
+        int nw = fdCountWeights(weights, n);
+        double * w = malloc(nw * sizeof(double));
+        for (int k = 0; k < nw; k++) w[k] = weights[k];
+        v = fdPowerSeriesInverse(w, nw, n);
+        free(w);
+        free(weights);
+    }
+    
+    for (int s = 0; s < horizon; s++) {
+        double sum = 0;
+        for (int j = 0; j < len; j++) sum += v[s+1+j] * df[j];
+        inv->history[s] = sum;
+    }
+    
+    inv->v = realloc(v, horizon * sizeof(double));
+    return inv;
+}
+
+// levels[0 .. h-1] for forecast[0 .. h-1], h up to the inverter's horizon
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+FD_NO_FMA void fdForecastInvert(const fdForecastInverter * inv, const float * forecast, int h, float * levels) {
+    if (h > inv->horizon) h = inv->horizon;
+    for (int s = 0; s < h; s++) {
+        double sum = inv->history[s];
+        for (int q = 0; q <= s; q++) sum += inv->v[q] * forecast[s-q];
+        levels[s] = (float)sum;
+    }
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT ON
+#endif
+
+void fdForecastInverterDestroy(fdForecastInverter * inv) {
+    if (!inv) return;
+    free(inv->v);
+    free(inv->history);
+    free(inv);
+}
+
+// ----
+// Chains of fractional operators
+
+// Differencing and integrating compose:  (1-B)^d1 (1-B)^d2 = (1-B)^(d1+d2), so fracDiff(d1) followed by fracDiff(d2)
+// is one fracDiff(d1+d2) (exactly, with the same finite-history edge, when both use all the weights).
+// A pipeline collects the operators and runs the chain as one pass instead of one O(n^2) pass per operator,
+// with no intermediate arrays:
+// - all full memory:  a single fracDiff with the summed d, or just a copy if the d's cancel out
+// - otherwise (truncated windows or thresholds):  the weight vectors are multiplied together as polynomials
+//   (convolved), since each step is Y = W X (mod z^n), and the product weights are run in one pass.
+//   The product of windows of K1 and K2 weights has K1 + K2 - 1 weights.
+// Operators with d = 0 are the identity and are dropped.
+
+// fdPipeline * p = fdPipelineCreate();
+// fdPipelineAdd(p, 0.4, 0, 0);      // same arguments as fracDiff
+// fdPipelineAdd(p, -0.4, 0, 0);
+// float * out = fdPipelineRun(p, series, len);   // calloc'd, caller frees
+// fdPipelineDestroy(p);
+
+typedef struct {
+    float d;
+    float threshold;
+    int useNWeights;
+} fdPipelineOp;
+
+typedef struct {
+    fdPipelineOp * ops;
+    int nOps;
+    int cap;
+} fdPipeline;
+
+fdPipeline * fdPipelineCreate(void) {
+    return calloc(1, sizeof(fdPipeline));
+}
+
+void fdPipelineAdd(fdPipeline * p, float d, float threshold, int useNWeights) {
+    if (d == 0) return; // identity
+    if (p->nOps == p->cap) {
+        p->cap = p->cap ? 2*p->cap : 4;
+        p->ops = realloc(p->ops, p->cap * sizeof(fdPipelineOp));
+    }
+    p->ops[p->nOps++] = (fdPipelineOp){d, threshold, useNWeights};
+}
+
+void fdPipelineDestroy(fdPipeline * p) {
+    if (!p) return;
+    free(p->ops);
+    free(p);
+}
+
+float * fdPipelineRun(fdPipeline * p, float * series, int len) {
+    
+    int fullMemory = 1;
+    double dSum = 0;
+    for (int k = 0; k < p->nOps; k++) {
+        fdPipelineOp * op = &p->ops[k];
+        if (op->threshold > 0 || (op->useNWeights > 0 && op->useNWeights < len)) fullMemory = 0;
+        dSum += op->d;
+    }
+    
+    if (fullMemory) {
+        if (p->nOps == 0 || fabs(dSum) < 1e-6) {
+            float * out = calloc(len, sizeof(float));
+            if (len > 0) memcpy(out, series, len * sizeof(float));
+            return out;
+        }
+        return fracDiff(series, len, (float)dSum, 0, 0);
+    }
+    
+    // multiply the weight polynomials together, in double, keeping the first len coefficients
+    double * w = malloc(len * sizeof(double));
+    w[0] = 1;
+    int nw = 1;
+    for (int k = 0; k < p->nOps; k++) {
+        fdPipelineOp * op = &p->ops[k];
+        float * wk = findWeights_ffd(op->d, len, op->threshold, op->useNWeights);
+        int nk = fdCountWeights(wk, len);
+        double * a = malloc(nk * sizeof(double));
+        for (int j = 0; j < nk; j++) a[j] = wk[j];
+        int nOut = nw + nk - 1 < len ? nw + nk - 1 : len;
+        if ((double)nw * nk < 64.0 * nOut) {
+            double * prod = calloc(nOut, sizeof(double));
+            for (int i = 0; i < nw; i++)
+                for (int j = 0; j < nk && i + j < nOut; j++) prod[i+j] += w[i] * a[j];
+            memcpy(w, prod, nOut * sizeof(double));
+            free(prod);
+        } else {
+            fdPolyMul(w, nw, a, nk, w, nOut);
+        }
+        nw = nOut;
+        free(a);
+        free(wk);
+    }
+    
+    float * weights = malloc(nw * sizeof(float));
+    for (int j = 0; j < nw; j++) weights[j] = (float)w[j];
+    float * out = calloc(len, sizeof(float));
+    fdConvolveRange(series, len, weights, fdCountWeights(weights, nw), 0, len, out);
+    
+    free(weights);
+    free(w);
+    return out;
+}
+
+// ----
+// Half precision (16 bit) storage for series, weights and output
+
+// For big panels of series the fracDiff loop is limited by how fast the data can be pulled in from memory,
+// not by the multiply-adds.  Storing the series, weights and output as 16 bit floats halves the
+// memory traffic and cache footprint.  The values are converted to float inside the dot product loop
+// and summed in float, so only the storage is 16 bit, not the arithmetic.
+
+// Two 16 bit formats are supported:
+// FD_FP16 = IEEE half:  11 bits of mantissa (~3 decimal digits), but max value 65504 and smallest normal 6.1e-5
+// FD_BF16 = bfloat16:  only 8 bits of mantissa (~2 decimal digits), but the same range as float
+
+// Accuracy cost measured against the float path (fracDiff with threshold 0, useNWeights 0, d = 0.4) on a random walk
+// price series around 100 of length 2000 (steps of +/- 0.5):
+// FD_FP16:  max abs error about 0.06, or 6e-4 of the largest output
+// FD_BF16:  max abs error about 0.4,  or 4e-3 of the largest output
+// Most of this is the rounding of the stored series (half stores 100 to within 0.03, bfloat16 to within 0.25),
+// not the weights or the sums.  So center/scale series into a modest range before storing
+// (e.g. log prices, or prices / first price) to get the most out of the mantissa, and prefer FD_FP16.
+// FD_BF16 is mainly for series whose range overflows half precision.
+// Also note that with half precision weights, full memory weights for d around 0.5 drop below the smallest half
+// subnormal (6e-8) after several thousand lags, so very long histories lose their far tail.
+
+// Build with -mf16c (or -march=native) for FD_FP16:  without it the half <-> float conversions are done in
+// plain C, one value at a time, and the 16 bit path ends up several times slower than the float one instead of faster.
+// FD_BF16 doesn't need it (its conversion is just a shift).
+
+#define FD_FP16 0
+#define FD_BF16 1
+
+// float -> half with round to nearest even, handles subnormals, inf and nan
+// (same bit results as the F16C hardware conversion)
+
+static uint16_t fdFloatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    x &= 0x7fffffff;
+    
+    if (x >= 0x7f800000) return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0); // inf or nan
+    if (x >= 0x477ff000) return sign | 0x7c00;                                // rounds up past 65504: inf
+    
+    if (x < 0x38800000) {
+        // result is a half subnormal (or zero):  adding 0.5 lines up the float mantissa so that
+        // the float add itself does the round to nearest even at the half subnormal spacing of 2^-24
+        float a;
+        memcpy(&a, &x, sizeof(a));
+        a += 0.5f;
+        memcpy(&x, &a, sizeof(x));
+        return sign | (uint16_t)(x - 0x3f000000);
+    }
+    
+    uint32_t odd = (x >> 13) & 1;
+    x += 0xc8000fff + odd; // rebias the exponent from 127 to 15 and round to nearest even
+    return sign | (uint16_t)(x >> 13);
+}
+
+static float fdHalfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t em = h & 0x7fff;
+    uint32_t x;
+    float f;
+    
+    if (em >= 0x7c00) x = 0x7f800000 | ((em & 0x3ff) << 13); // inf or nan
+    else if (em >= 0x0400) x = (em << 13) + 0x38000000;     // normal:  rebias the exponent from 15 to 127
+    else {
+        f = em * 5.9604644775390625e-8f;                     // subnormal:  mantissa * 2^-24, exact in float
+        memcpy(&x, &f, sizeof(x));
+    }
+    x |= sign;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// bfloat16 is just the top half of a float, so only the rounding needs care
+
+static uint16_t fdFloatToBF16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) return (uint16_t)((x >> 16) | 0x40); // keep nan a (quiet) nan
+    x += 0x7fff + ((x >> 16) & 1);                                        // round to nearest even
+    return (uint16_t)(x >> 16);
+}
+
+static float fdBF16ToFloat(uint16_t b) {
+    uint32_t x = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// convert an array of floats to 16 bit storage in the given format (FD_FP16 or FD_BF16)
+
+void fdPack16(const float * src, uint16_t * dst, int n, int format) {
+    int i = 0;
+    if (format == FD_BF16) {
+        for (; i < n; i++) dst[i] = fdFloatToBF16(src[i]);
+        return;
+    }
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < n; i++) dst[i] = fdFloatToHalf(src[i]);
+}
+
+// and back to float
+
+void fdUnpack16(const uint16_t * src, float * dst, int n, int format) {
+    int i = 0;
+    if (format == FD_BF16) {
+        for (; i < n; i++) dst[i] = fdBF16ToFloat(src[i]);
+        return;
+    }
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+    for (; i < n; i++) dst[i] = fdHalfToFloat(src[i]);
+}
+
+// dot product of n 16 bit values with n 16 bit weights, converted on the fly, summed in float
+
+static float fdDot16(const uint16_t * x, const uint16_t * w, int n, int format) {
+    
+    int j = 0;
+    float sum = 0;
+    
+    if (format == FD_FP16) {
+#if defined(__AVX512F__)
+        __m512 acc16 = _mm512_setzero_ps();
+        for (; j + 16 <= n; j += 16) {
+            __m512 xv = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x + j)));
+            __m512 wv = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(w + j)));
+            acc16 = _mm512_add_ps(acc16, _mm512_mul_ps(xv, wv));
+        }
+        sum += _mm512_reduce_add_ps(acc16);
+#endif
+#if defined(__F16C__)
+        __m256 acc8 = _mm256_setzero_ps();
+        for (; j + 8 <= n; j += 8) {
+            __m256 xv = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + j)));
+            __m256 wv = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(w + j)));
+            acc8 = _mm256_add_ps(acc8, _mm256_mul_ps(xv, wv));
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, acc8);
+        for (int k = 0; k < 8; k++) sum += lanes[k];
+#endif
+        for (; j < n; j++) sum += fdHalfToFloat(x[j]) * fdHalfToFloat(w[j]);
+        return sum;
+    }
+    
+    // bfloat16:  the conversion is a shift, so with 8 separate partial sums
+    // the compiler can vectorize this loop without any intrinsics
+    float acc[8] = {0};
+    for (; j + 8 <= n; j += 8)
+        for (int k = 0; k < 8; k++) acc[k] += fdBF16ToFloat(x[j+k]) * fdBF16ToFloat(w[j+k]);
+    for (int k = 0; k < 8; k++) sum += acc[k];
+    for (; j < n; j++) sum += fdBF16ToFloat(x[j]) * fdBF16ToFloat(w[j]);
+    return sum;
+}
+
+// Same as fracDiff() but the series, the weights, and the output are stored in 16 bit format (FD_FP16 or FD_BF16).
+// Use fdPack16() / fdUnpack16() to convert to and from float arrays.
+// Returns a calloc'd array of len 16 bit values, caller must free().
+
+uint16_t * fracDiff16(const uint16_t * series, int len, float d, float threshold, int useNWeights, int format) {
+    
+    float * wf = findWeights_ffd(d, len, threshold, useNWeights); // generate the weights in float
+    int nw = fdCountWeights(wf, len);                             // only the window is used
+    uint16_t * weights = malloc(nw * sizeof(uint16_t));           // and store them as 16 bit too
+    fdPack16(wf, weights, nw, format);
+    free(wf);
+    
+    uint16_t * df_temp = calloc(len, sizeof(uint16_t)); // for output
+    
+    for (int i = 0; i < len; i++) {
+        float sum = fdDot16(series + i, weights, len - i < nw ? len - i : nw, format);
+        df_temp[i] = format == FD_BF16 ? fdFloatToBF16(sum) : fdFloatToHalf(sum);
+    }
+    
+    free(weights);
+    
+    return df_temp;
+}
+
+// ----
+// Persistent thread pool
+
+// Starting threads costs tens of microseconds each, which is more than a whole fracDiff of a few thousand points
+// takes per thread.  So the threaded routines below share a pool of worker threads that is started once and then
+// kept around.  Idle workers spin for a short while before going to sleep, so a burst of submitted tasks is picked up
+// within a microsecond or so instead of paying a sleep / wake up round trip for each one.
+
+// Usage:
+//   fdTaskGroup g = FD_TASK_GROUP_INIT;
+//   fdPoolSubmit(pool, &g, someFunction, someArg);  // as many as you like
+//   fdPoolWait(pool, &g);                           // returns when all of this group's tasks are done
+
+// The thread calling fdPoolWait() also runs queued tasks while it waits, so tasks may submit and wait on their own
+// sub-tasks without tying up the pool, and a pool with 0 workers just runs everything in the waiting thread.
+
+// Threads use pthreads, available on Mac, linux and other unix type systems (not plain Windows compilers).
+// That is what the -lpthread on the gcc command above is for:  linux may need it, Mac doesn't.
+
+typedef void (*fdTaskFn)(void * arg);
+
+typedef struct {
+    atomic_int pending;   // tasks submitted to this group but not finished
+} fdTaskGroup;
+
+#define FD_TASK_GROUP_INIT {0}
+
+typedef struct {
+    fdTaskFn fn;
+    void * arg;
+    fdTaskGroup * group;
+} fdTask;
+
+typedef struct {
+    pthread_t * threads;
+    int nThreads;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;   // signaled when a task is queued and a worker is asleep
+    pthread_cond_t doneCond;   // broadcast when some group's last task finishes
+    
+    fdTask * queue;            // ring buffer of queued tasks, grows as needed
+    int cap, head, count;
+    int sleepers;
+    
+    atomic_int queued;         // same as count, but readable without the lock by spinning workers
+    atomic_int stop;
+    
+    int * workerCpu;           // cpu each worker is pinned to, -1 if not pinned
+    struct fdWorkerStart * starts;
+} fdPool;
+
+typedef struct fdWorkerStart {
+    fdPool * pool;
+    int index;
+} fdWorkerStart;
+
+// which worker of which pool the current thread is (-1 and NULL for threads the pool didn't start)
+static _Thread_local int fdWorkerIndex = -1;
+static _Thread_local fdPool * fdWorkerPool = NULL;
+
+// how long an idle worker keeps checking for new tasks before it sleeps (roughly tens of microseconds)
+#define FD_POOL_SPIN 4000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FD_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define FD_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define FD_CPU_RELAX() ((void)0)
+#endif
+
+// cpus this process may run on:  under taskset, or in a container limited to a cpuset, that is fewer than the machine has
+// (linux only; elsewhere all the online cpus)
+
+#if defined(__linux__)
+static int fdCpuAllowed(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 1;
+    return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+}
+#endif
+
+static int fdCpuCount(void) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) return CPU_COUNT(&set);
+#endif
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// ----
+// NUMA topology
+
+// On a 2 socket server each socket has its own memory, and reading memory attached to the other socket
+// is slower and competes for the link between the sockets.  Linux places a page of memory on the node of the
+// thread that first writes to it ("first touch"), so the trick is to have data first written by a thread
+// on the node that is going to read it.
+
+// The node layout is read from /sys/devices/system/node on linux.  Elsewhere (e.g. Mac) everything is one node.
+
+typedef struct {
+    int nNodes;
+    int nCpus;        // cpu ids go 0 .. nCpus-1
+    int nAllowed;     // how many of those this process may use (see fdCpuCount)
+    int * cpuNode;    // node of each cpu
+    int * cpuOrder;   // the allowed cpus interleaved across nodes: first cpu of each node, then the second of each node, ...
+} fdTopology;
+
+static fdTopology fdTopo;
+static pthread_once_t fdTopoOnce = PTHREAD_ONCE_INIT;
+
+static void fdTopoInit(void) {
+    
+    fdTopo.nCpus = fdCpuCount();
+    long conf = sysconf(_SC_NPROCESSORS_CONF);
+    if (conf > fdTopo.nCpus) fdTopo.nCpus = (int)conf;
+    fdTopo.nAllowed = 0;
+    fdTopo.nNodes = 1;
+    fdTopo.cpuNode = calloc(fdTopo.nCpus, sizeof(int));
+    fdTopo.cpuOrder = malloc(fdTopo.nCpus * sizeof(int));
+    
+#if defined(__linux__)
+    // each node lists its cpus like "0-7,16-23"
+    for (int node = 0; ; node++) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE * f = fopen(path, "r");
+        if (!f) break;
+        int a, b;
+        while (fscanf(f, "%d", &a) == 1) {
+            b = a;
+            int c = fgetc(f);
+            if (c == '-') {
+                if (fscanf(f, "%d", &b) != 1) break;
+                c = fgetc(f);
+            }
+            for (int cpu = a; cpu <= b && cpu < fdTopo.nCpus; cpu++) fdTopo.cpuNode[cpu] = node;
+            if (c != ',') break;
+        }
+        fclose(f);
+        if (node + 1 > fdTopo.nNodes) fdTopo.nNodes = node + 1;
+    }
+#endif
+    
+    char * allowed = calloc(fdTopo.nCpus, 1);
+    for (int cpu = 0; cpu < fdTopo.nCpus; cpu++) {
+#if defined(__linux__)
+        allowed[cpu] = fdCpuAllowed(cpu);
+#else
+        allowed[cpu] = 1;
+#endif
+        fdTopo.nAllowed += allowed[cpu];
+    }
+    if (fdTopo.nAllowed == 0) { // can't tell, so allow them all
+        memset(allowed, 1, fdTopo.nCpus);
+        fdTopo.nAllowed = fdTopo.nCpus;
+    }
+    
+    int n = 0;
+    for (int rank = 0; n < fdTopo.nAllowed; rank++) {
+        for (int node = 0; node < fdTopo.nNodes; node++) {
+            int seen = 0;
+            for (int cpu = 0; cpu < fdTopo.nCpus; cpu++) {
+                if (!allowed[cpu] || fdTopo.cpuNode[cpu] != node) continue;
+                if (seen++ == rank) {
+                    fdTopo.cpuOrder[n++] = cpu;
+                    break;
+                }
+            }
+        }
+    }
+    free(allowed);
+}
+
+static fdTopology * fdGetTopology(void) {
+    pthread_once(&fdTopoOnce, fdTopoInit);
+    return &fdTopo;
+}
+
+int fdNumaNodes(void) {
+    return fdGetTopology()->nNodes;
+}
+
+// node of the cpu this thread is running on right now (0 where we can't tell)
+
+static int fdCurrentNode(void) {
+    fdTopology * topo = fdGetTopology();
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < topo->nCpus) return topo->cpuNode[cpu];
+#endif
+    (void)topo;
+    return 0;
+}
+
+// pop a task off the queue, caller holds the lock
+
+static int fdPoolPopLocked(fdPool * pool, fdTask * t) {
+    if (pool->count == 0) return 0;
+    *t = pool->queue[pool->head];
+    pool->head = (pool->head + 1) % pool->cap;
+    pool->count--;
+    atomic_fetch_sub(&pool->queued, 1);
+    return 1;
+}
+
+static int fdPoolTryPop(fdPool * pool, fdTask * t) {
+    if (atomic_load(&pool->queued) == 0) return 0;
+    pthread_mutex_lock(&pool->lock);
+    int got = fdPoolPopLocked(pool, t);
+    pthread_mutex_unlock(&pool->lock);
+    return got;
+}
+
+static void fdPoolRun(fdPool * pool, fdTask * t) {
+    t->fn(t->arg);
+    if (atomic_fetch_sub(&t->group->pending, 1) == 1) {
+        // last task of the group:  wake whoever is waiting on it
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->doneCond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void * fdPoolWorker(void * arg) {
+    
+    fdWorkerStart * start = arg;
+    fdPool * pool = start->pool;
+    fdWorkerIndex = start->index;
+    fdWorkerPool = pool;
+    
+    for (;;) {
+        // spin first, then sleep
+        for (int spin = 0; spin < FD_POOL_SPIN && atomic_load(&pool->queued) == 0 && !atomic_load(&pool->stop); spin++)
+            FD_CPU_RELAX();
+        
+        fdTask t;
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0 && !atomic_load(&pool->stop)) {
+            pool->sleepers++;
+            pthread_cond_wait(&pool->workCond, &pool->lock);
+            pool->sleepers--;
+        }
+        if (!fdPoolPopLocked(pool, &t)) { // only happens when stopping
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        
+        fdPoolRun(pool, &t);
+    }
+}
+
+// pin a thread to one cpu so it keeps its caches (linux only, Mac has no hard affinity call, so this does nothing there).
+// Returns 0 if the thread is now pinned to that cpu.
+
+static int fdPinThread(pthread_t thread, int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+    return -1;
+#endif
+}
+
+// Start a pool of nThreads workers (0 is allowed, then the waiting thread does all the work).
+// If pin is nonzero, each worker is pinned to its own cpu, going round the NUMA nodes in turn
+// so that a pool smaller than the machine still uses every socket.
+
+fdPool * fdPoolCreate(int nThreads, int pin) {
+    
+    fdPool * pool = calloc(1, sizeof(fdPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+    pool->cap = 64;
+    pool->queue = malloc(pool->cap * sizeof(fdTask));
+    
+    fdTopology * topo = fdGetTopology();
+    int n = nThreads > 0 ? nThreads : 1;
+    pool->threads = calloc(n, sizeof(pthread_t));
+    pool->workerCpu = malloc(n * sizeof(int));
+    pool->starts = malloc(n * sizeof(fdWorkerStart));
+    for (int k = 0; k < nThreads; k++) {
+        pool->starts[k] = (fdWorkerStart){pool, k};
+        if (pthread_create(&pool->threads[k], NULL, fdPoolWorker, &pool->starts[k]) != 0) break;
+        pool->workerCpu[k] = pin ? topo->cpuOrder[k % topo->nAllowed] : -1;
+        if (pin && fdPinThread(pool->threads[k], pool->workerCpu[k]) != 0) pool->workerCpu[k] = -1; // not pinned after all
+        pool->nThreads++;
+    }
+    
+    return pool;
+}
+
+// number of worker threads (not counting the waiting thread, which also works)
+
+int fdPoolSize(fdPool * pool) {
+    return pool->nThreads;
+}
+
+void fdPoolSubmit(fdPool * pool, fdTaskGroup * group, fdTaskFn fn, void * arg) {
+    
+    atomic_fetch_add(&group->pending, 1);
+    
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count == pool->cap) {
+        // full:  double the ring buffer, unwrapping it into the new space
+        fdTask * q = malloc(2 * pool->cap * sizeof(fdTask));
+        for (int k = 0; k < pool->count; k++) q[k] = pool->queue[(pool->head + k) % pool->cap];
+        free(pool->queue);
+        pool->queue = q;
+        pool->head = 0;
+        pool->cap *= 2;
+    }
+    fdTask * t = &pool->queue[(pool->head + pool->count) % pool->cap];
+    t->fn = fn;
+    t->arg = arg;
+    t->group = group;
+    pool->count++;
+    atomic_fetch_add(&pool->queued, 1);
+    if (pool->sleepers > 0) pthread_cond_signal(&pool->workCond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// wait until all tasks submitted to group are done, running queued tasks in the meantime
+
+void fdPoolWait(fdPool * pool, fdTaskGroup * group) {
+    
+    while (atomic_load(&group->pending) > 0) {
+        fdTask t;
+        if (fdPoolTryPop(pool, &t)) {
+            fdPoolRun(pool, &t);
+            continue;
+        }
+        
+        // nothing left to help with, the last few tasks are running on workers
+        for (int spin = 0; spin < FD_POOL_SPIN && atomic_load(&group->pending) > 0 && atomic_load(&pool->queued) == 0; spin++)
+            FD_CPU_RELAX();
+        
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&group->pending) > 0 && pool->count == 0)
+            pthread_cond_wait(&pool->doneCond, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// stop and join the workers (any queued tasks are finished first), and free the pool
+
+void fdPoolDestroy(fdPool * pool) {
+    
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->stop, 1);
+    pthread_cond_broadcast(&pool->workCond);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int k = 0; k < pool->nThreads; k++) pthread_join(pool->threads[k], NULL);
+    
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workCond);
+    pthread_cond_destroy(&pool->doneCond);
+    free(pool->threads);
+    free(pool->workerCpu);
+    free(pool->starts);
+    free(pool->queue);
+    free(pool);
+}
+
+// The library's own pool, used by the threaded routines below.  It is started the first time it is needed,
+// with one pinned worker per cpu but one unless fdSetPoolSize() was called first (the calling thread works too,
+// and takes the last cpu).
+
+static fdPool * fdDefault = NULL;
+static int fdDefaultSize = -1;
+static pthread_mutex_t fdDefaultLock = PTHREAD_MUTEX_INITIALIZER;
+
+fdPool * fdDefaultPool(void) {
+    pthread_mutex_lock(&fdDefaultLock);
+    if (!fdDefault) fdDefault = fdPoolCreate(fdDefaultSize >= 0 ? fdDefaultSize : fdCpuCount() - 1, 1);
+    pthread_mutex_unlock(&fdDefaultLock);
+    return fdDefault;
+}
+
+// Set the number of workers in the library's pool.  If the pool is already running it is restarted with the new size,
+// so don't call this while threaded work is in flight.
+
+void fdSetPoolSize(int nThreads) {
+    pthread_mutex_lock(&fdDefaultLock);
+    fdDefaultSize = nThreads;
+    if (fdDefault) {
+        fdPoolDestroy(fdDefault);
+        fdDefault = NULL;
+    }
+    pthread_mutex_unlock(&fdDefaultLock);
+}
+
+// ----
+// Many independent fracDiff calls at once on the pool
+
+// Fill in the inputs, submit as many jobs as you like to a task group, then fdPoolWait() on the group.
+// result is then the same calloc'd array fracDiff() would have returned (caller must free()).
+// The job structs must stay put until the wait returns.
+
+typedef struct {
+    float * series;
+    int len;
+    float d;
+    float threshold;
+    int useNWeights;
+    float * result;
+} fdJob;
+
+static void fdJobRun(void * arg) {
+    fdJob * job = arg;
+    job->result = fracDiff(job->series, job->len, job->d, job->threshold, job->useNWeights);
+}
+
+void fdSubmitFracDiff(fdPool * pool, fdTaskGroup * group, fdJob * job) {
+    fdPoolSubmit(pool, group, fdJobRun, job);
+}
+
+// ----
+// One fracDiff split across the pool
+
+// Same result as fracDiff() (bit for bit, each output is the same dot product in the same order),
+// the outputs are just divided up between threads.
+// With all weights, output i costs len-i multiply-adds, so the early outputs are much more work than the late ones:
+// the chunks are cut to have equal amounts of work, not equal numbers of outputs.
+// There are a few chunks per thread so a thread that gets held up doesn't hold up the whole call.
+
+// below this length a single thread is faster than handing out the work
+#define FD_PARALLEL_MIN_LEN 512
+
+typedef struct {
+    const float * series;
+    const float * weights;
+    int len, nw, from, to;
+    float * out;
+} fdRangeTask;
+
+static void fdRangeTaskRun(void * arg) {
+    fdRangeTask * t = arg;
+    fdConvolveRange(t->series, t->len, t->weights, t->nw, t->from, t->to, t->out);
+}
+
+// applyFilter() split across the default pool, same results.  out must not be the series array here
+// (other threads may still be reading the series when one writes its outputs).
+
+void applyFilterParallel(const float * series, int len, const float * weights, int K, float * df_temp) {
+    
+    fdPool * pool = fdDefaultPool();
+    int nThreads = fdPoolSize(pool) + 1; // the calling thread helps too
+    
+    if (len < FD_PARALLEL_MIN_LEN || nThreads == 1) {
+        applyFilter(series, len, weights, K, df_temp);
+        return;
+    }
+    
+    int nw = fdCountWeights(weights, K < len ? K : len);
+    
+    int nChunks = 4 * nThreads;
+    fdRangeTask * tasks = malloc(nChunks * sizeof(fdRangeTask));
+    fdTaskGroup group = FD_TASK_GROUP_INIT;
+    
+    double total = fdRangeWork(len, nw, 0, len);
+    double work = 0;
+    int from = 0, n = 0;
+    for (int i = 0; i < len; i++) {
+        work += len - i < nw ? len - i : nw;
+        if (work >= total * (n + 1) / nChunks || i == len - 1) {
+            tasks[n] = (fdRangeTask){series, weights, len, nw, from, i + 1, df_temp};
+            fdPoolSubmit(pool, &group, fdRangeTaskRun, &tasks[n]);
+            n++;
+            from = i + 1;
+        }
+    }
+    fdPoolWait(pool, &group);
+    
+    free(tasks);
+}
+
+// the blocked suffix scan (fdSuffixScan) with steps 1 and 3 spread over the pool, same bits as on one thread
+
+typedef struct {
+    double * acc;
+    double * totals;
+    float * out;
+    int len, k0, k1;
+    int add;          // 0 = step 1, 1 = step 3
+} fdScanTask;
+
+static void fdScanTaskRun(void * arg) {
+    fdScanTask * t = arg;
+    if (t->add) fdScanAdd(t->acc, t->len, t->k0, t->k1, t->totals, t->out);
+    else fdScanBlocks(t->acc, t->len, t->k0, t->k1, t->totals);
+}
+
+static void fdSuffixScanParallel(fdPool * pool, const float * series, int len, int passes, float * out) {
+    
+    int nBlocks = fdScanBlockCount(len);
+    int nTasks = 2 * (fdPoolSize(pool) + 1);
+    if (nTasks > nBlocks) nTasks = nBlocks;
+    double * acc = malloc(len * sizeof(double));
+    double * totals = malloc(nBlocks * sizeof(double));
+    fdScanTask * tasks = malloc(nTasks * sizeof(fdScanTask));
+    for (int i = 0; i < len; i++) acc[i] = series[i];
+    
+    for (int pass = 0; pass < passes; pass++) {
+        for (int add = 0; add < 2; add++) {
+            fdTaskGroup group = FD_TASK_GROUP_INIT;
+            for (int t = 0; t < nTasks; t++) {
+                tasks[t] = (fdScanTask){acc, totals, pass == passes - 1 ? out : NULL, len,
+                                        (int)((long)nBlocks * t / nTasks), (int)((long)nBlocks * (t + 1) / nTasks), add};
+                fdPoolSubmit(pool, &group, fdScanTaskRun, &tasks[t]);
+            }
+            fdPoolWait(pool, &group);
+            if (!add) fdScanOffsets(totals, nBlocks);
+        }
+    }
+    
+    free(acc);
+    free(totals);
+    free(tasks);
+}
+
+float * fracDiffParallel(float * series, int len, float d, float threshold, int useNWeights) {
+    
+    int passes = fdScanPasses(len, d, threshold, useNWeights);
+    if (passes && len >= 4 * FD_SCAN_BLOCK && fdPoolSize(fdDefaultPool()) > 0) {
+        // negative whole d:  the O(n) scan, threaded once there are enough blocks to share out
+        float * df_temp = calloc(len, sizeof(float));
+        fdSuffixScanParallel(fdDefaultPool(), series, len, passes, df_temp);
+        return df_temp;
+    }
+    
+    if (passes || len < FD_PARALLEL_MIN_LEN || fdPoolSize(fdDefaultPool()) == 0) return fracDiff(series, len, d, threshold, useNWeights);
+    
+    float * weights = findWeights_ffd(d, len, threshold, useNWeights); // generate the weights once for all threads
+    float * df_temp = calloc(len, sizeof(float));                      // for output
+    
+    applyFilterParallel(series, len, weights, len, df_temp);
+    
+    free(weights);
+    
+    return df_temp;
+}
+
+// ----
+// Work stealing fracDiff of a whole panel of series with very different lengths
+
+// A full memory fracDiff of a series of length n costs about n^2/2 multiply-adds, so a panel mixing
+// 30 year daily histories with a few hundred points of a new listing is very lopsided:  handing each thread
+// a fixed set of series leaves most threads idle while one grinds through the long ones.
+
+// So here each thread (pool workers plus the calling thread) gets its own deque of output ranges.
+// A thread takes ranges off the bottom of its own deque; if a range is more than a grain of work,
+// it cuts it in two halves of equal work, pushes one half back (where others can steal it) and keeps cutting
+// the other.  A thread whose deque is empty steals from the top of another thread's deque, which is where the
+// biggest, not yet cut up pieces are.  So long series get spread over all the threads and short ones
+// fill in the gaps, and the wall time ends up close to total work / number of threads.
+
+// Each output is still the same dot product in the same order as fracDiff(), so results are identical to calling
+// fracDiff() on each series.
+
+// On NUMA machines (see the topology notes above) each series also gets a home node, with the work balanced
+// across the nodes.  The first thread to start on a node copies that node's input series, zeroes its outputs and
+// makes its own copy of the (read only, shared) weights, so all of those pages live on that node.
+// Threads steal from deques on their own node first and only go to the other node when their node runs dry.
+// This only happens when the pool's threads actually sit on more than one node; on a one node host (and whenever
+// the pool ended up on a single node) the outputs are just calloc'd by the calling thread.
+
+// fracDiffPanel() is the only NUMA aware entry point.  fdSubmitFracDiff(), fracDiffParallel(), fdForecastInvertPaths(),
+// fdArfimaPaths() and fdFgnPaths() leave placement to the caller's buffers, or to whichever thread happens to
+// allocate, so on a multi socket server give them buffers first touched on the node that will use them.
+
+typedef struct {
+    int series;     // which series in the panel
+    int from, to;   // output range
+} fdRange;
+
+typedef struct {
+    pthread_mutex_t lock;
+    fdRange * items;
+    int top, bottom, cap;   // items[top..bottom-1] are queued; steal at top, push/pop at bottom
+} fdDeque;
+
+typedef struct {
+    float ** series;
+    const int * lens;
+    float ** out;
+    const float * weights;
+    int nWeights;              // length of the weights array
+    int nw;                    // number of them in use
+    
+    fdDeque * deques;          // one per pool worker, plus one (the last) for the calling thread
+    int * dequeNode;           // node of the thread owning each deque
+    int nDeques;
+    atomic_long outputsLeft;   // when this hits 0 everyone is done
+    double grain;              // ranges with more work than this get cut in two
+    
+    // NUMA placement, only used when there is more than one node
+    int nNodes;
+    int nSeries;
+    int * home;                // home node of each series
+    float ** local;            // node local copy of each input series
+    float ** nodeWeights;      // copy of the weights on each node
+    atomic_int * nodeReady;    // 0 = not set up yet, 1 = being set up, 2 = ready
+} fdStealExec;
+
+static void fdDequePush(fdDeque * q, fdRange r) {
+    pthread_mutex_lock(&q->lock);
+    if (q->bottom == q->cap) {
+        // out of room at the bottom:  slide the queued items back to the start, or grow
+        int n = q->bottom - q->top;
+        if (q->top > q->cap / 2) memmove(q->items, q->items + q->top, n * sizeof(fdRange));
+        else {
+            q->cap *= 2;
+            fdRange * items = malloc(q->cap * sizeof(fdRange));
+            memcpy(items, q->items + q->top, n * sizeof(fdRange));
+            free(q->items);
+            q->items = items;
+        }
+        q->top = 0;
+        q->bottom = n;
+    }
+    q->items[q->bottom++] = r;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int fdDequePop(fdDeque * q, fdRange * r, int steal) {
+    pthread_mutex_lock(&q->lock);
+    int got = q->bottom > q->top;
+    if (got) *r = steal ? q->items[q->top++] : q->items[--q->bottom];
+    pthread_mutex_unlock(&q->lock);
+    return got;
+}
+
+// first touch everything that lives on node:  runs once per node, on a thread of that node if there is one
+
+static void fdStealNodeSetup(fdStealExec * ex, int node) {
+    
+    int expect = 0;
+    if (!atomic_compare_exchange_strong(&ex->nodeReady[node], &expect, 1)) {
+        while (atomic_load(&ex->nodeReady[node]) != 2) FD_CPU_RELAX(); // someone else is on it
+        return;
+    }
+    
+    ex->nodeWeights[node] = malloc(ex->nWeights * sizeof(float));
+    memcpy(ex->nodeWeights[node], ex->weights, ex->nWeights * sizeof(float));
+    
+    for (int s = 0; s < ex->nSeries; s++) {
+        if (ex->home[s] != node || ex->lens[s] == 0) continue;
+        ex->local[s] = malloc(ex->lens[s] * sizeof(float));
+        memcpy(ex->local[s], ex->series[s], ex->lens[s] * sizeof(float));
+        ex->out[s] = malloc(ex->lens[s] * sizeof(float));
+        memset(ex->out[s], 0, ex->lens[s] * sizeof(float));
+    }
+    
+    atomic_store(&ex->nodeReady[node], 2);
+}
+
+// failed looks for work before an idle thread starts yielding its cpu
+#define FD_STEAL_SPIN 64
+
+static void fdStealLoop(void * arg) {
+    
+    fdStealExec * ex = arg;
+    fdRange r;
+    int idle = 0; // looks in a row that found nothing
+    
+    // the deque that goes with this thread:  a pool worker's own, or the calling thread's (the last one)
+    int me = fdWorkerPool != NULL && fdWorkerIndex >= 0 && fdWorkerIndex < ex->nDeques - 1 ? fdWorkerIndex : ex->nDeques - 1;
+    int myNode = ex->dequeNode[me];
+    const float * weights = ex->weights;
+    if (ex->nNodes > 1) {
+        fdStealNodeSetup(ex, myNode);
+        weights = ex->nodeWeights[myNode];
+    }
+    
+    while (atomic_load(&ex->outputsLeft) > 0) {
+        
+        // own work first, then go round the others looking for something to steal,
+        // on this node first, then on the other nodes
+        int got = fdDequePop(&ex->deques[me], &r, 0);
+        for (int remote = 0; remote < 2 && !got; remote++)
+            for (int k = 1; !got && k < ex->nDeques; k++) {
+                int q = (me + k) % ex->nDeques;
+                if ((ex->dequeNode[q] != myNode) == remote) got = fdDequePop(&ex->deques[q], &r, 1);
+            }
+        
+        if (!got) {
+            // everything is taken, but some may still be cut up and pushed back by the others.
+            // Spin a little, then give the cpu up between looks:  the default pool has a pinned worker on
+            // every cpu but one, and a spinning thread sharing a cpu with the worker that holds the last range
+            // would only slow that range down.
+            if (++idle < FD_STEAL_SPIN) FD_CPU_RELAX();
+            else sched_yield();
+            continue;
+        }
+        idle = 0;
+        
+        int len = ex->lens[r.series];
+        
+        // cut the range down to grain size, leaving the other halves for whoever wants them
+        while (r.to - r.from > 1 && fdRangeWork(len, ex->nw, r.from, r.to) > ex->grain) {
+            double half = fdRangeWork(len, ex->nw, r.from, r.to) / 2;
+            int lo = r.from + 1, hi = r.to - 1; // find mid with about half the work on each side
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (fdRangeWork(len, ex->nw, r.from, mid) < half) lo = mid + 1;
+                else hi = mid;
+            }
+            fdDequePush(&ex->deques[me], (fdRange){r.series, lo, r.to});
+            r.to = lo;
+        }
+        
+        const float * x = ex->series[r.series];
+        if (ex->nNodes > 1) {
+            // stolen from another node:  its setup may not have happened yet if none of its threads got going
+            fdStealNodeSetup(ex, ex->home[r.series]);
+            x = ex->local[r.series];
+        }
+        
+        fdConvolveRange(x, len, weights, ex->nw, r.from, r.to, ex->out[r.series]);
+        atomic_fetch_sub(&ex->outputsLeft, r.to - r.from);
+    }
+}
+
+// fracDiff every series in the panel:  series[s] has length lens[s], all with the same d, threshold and useNWeights.
+// Returns a malloc'd array of nSeries outputs, each zero filled (calloc'd, or malloc'd and zeroed by a thread
+// on its home node when there is more than one node) and the same as fracDiff() would give for that series.
+// Caller must free() each output and then the array.
+
+float ** fracDiffPanel(float ** series, const int * lens, int nSeries, float d, float threshold, int useNWeights) {
+    
+    fdPool * pool = fdDefaultPool();
+    int nThreads = fdPoolSize(pool) + 1; // the calling thread helps too
+    fdTopology * topo = fdGetTopology();
+    
+    float ** out = calloc(nSeries, sizeof(float *));
+    
+    // negative whole d:  the series fracDiff() would do by the O(n) scan (see fdSuffixScan) have nothing to balance,
+    // so they just go to the pool as they are.  Whether it is the scan depends on the length (with useNWeights set,
+    // only series no longer than the window are), so this is decided series by series, the same as fracDiff() does.
+    // The rest go through the work stealing below, with the scanned ones counted as empty there.
+    int * stealLens = malloc(nSeries * sizeof(int));
+    int nScanned = 0;
+    for (int s = 0; s < nSeries; s++) {
+        stealLens[s] = fdScanPasses(lens[s], d, threshold, useNWeights) ? 0 : lens[s];
+        nScanned += stealLens[s] != lens[s];
+    }
+    if (nScanned > 0) {
+        fdJob * jobs = malloc(nSeries * sizeof(fdJob));
+        fdTaskGroup group = FD_TASK_GROUP_INIT;
+        for (int s = 0; s < nSeries; s++) {
+            if (stealLens[s] == lens[s]) continue;
+            jobs[s] = (fdJob){series[s], lens[s], d, threshold, useNWeights, NULL};
+            fdSubmitFracDiff(pool, &group, &jobs[s]);
+        }
+        fdPoolWait(pool, &group);
+        for (int s = 0; s < nSeries; s++) if (stealLens[s] != lens[s]) out[s] = jobs[s].result;
+        free(jobs);
+    }
+    lens = stealLens;
+    
+    // the weights don't depend on the series length (the recurrence just runs longer for longer series),
+    // so one set for the longest series works for all of them
+    int maxLen = 0;
+    long totalOutputs = 0;
+    for (int s = 0; s < nSeries; s++) {
+        if (lens[s] > maxLen) maxLen = lens[s];
+        totalOutputs += lens[s];
+    }
+    
+    float * weights = maxLen > 0 ? findWeights_ffd(d, maxLen, threshold, useNWeights) : NULL;
+    int nw = maxLen > 0 ? fdCountWeights(weights, maxLen) : 0;
+    
+    double totalWork = 0;
+    for (int s = 0; s < nSeries; s++) totalWork += fdRangeWork(lens[s], nw, 0, lens[s]);
+    
+    fdStealExec ex;
+    memset(&ex, 0, sizeof(ex));
+    ex.series = series;
+    ex.lens = lens;
+    ex.out = out;
+    ex.nSeries = nSeries;
+    ex.weights = weights;
+    ex.nWeights = maxLen;
+    ex.nw = nw;
+    ex.nDeques = nThreads;
+    ex.deques = calloc(nThreads, sizeof(fdDeque));
+    ex.dequeNode = calloc(nThreads, sizeof(int));
+    atomic_init(&ex.outputsLeft, totalOutputs);
+    ex.grain = totalWork / (16.0 * nThreads);
+    if (ex.grain < 32768) ex.grain = 32768;
+    
+    for (int k = 0; k < nThreads; k++) {
+        pthread_mutex_init(&ex.deques[k].lock, NULL);
+        ex.deques[k].cap = nSeries / nThreads + 16;
+        ex.deques[k].items = malloc(ex.deques[k].cap * sizeof(fdRange));
+        if (k < nThreads - 1 && pool->workerCpu[k] >= 0) ex.dequeNode[k] = topo->cpuNode[pool->workerCpu[k]];
+        else if (k == nThreads - 1) ex.dequeNode[k] = fdCurrentNode();
+    }
+    
+    // only bother with node placement if there is more than one node with threads on it
+    ex.nNodes = 1;
+    for (int k = 0; k < nThreads; k++)
+        if (ex.dequeNode[k] != ex.dequeNode[0]) ex.nNodes = topo->nNodes;
+    
+    if (ex.nNodes == 1) {
+        for (int s = 0; s < nSeries; s++) if (!out[s]) out[s] = calloc(lens[s], sizeof(float));
+    } else {
+        ex.home = calloc(nSeries, sizeof(int));
+        ex.local = calloc(nSeries, sizeof(float *));
+        ex.nodeWeights = calloc(ex.nNodes, sizeof(float *));
+        ex.nodeReady = calloc(ex.nNodes, sizeof(atomic_int));
+        
+        // give each series to the node with the least work per thread so far, biggest series first
+        int * order = malloc(nSeries * sizeof(int));
+        double * nodeWork = calloc(ex.nNodes, sizeof(double));
+        int * nodeThreads = calloc(ex.nNodes, sizeof(int));
+        for (int k = 0; k < nThreads; k++) nodeThreads[ex.dequeNode[k]]++;
+        for (int s = 0; s < nSeries; s++) order[s] = s;
+        for (int a = 1; a < nSeries; a++) { // insertion sort by length, longest first
+            int s = order[a], b = a;
+            for (; b > 0 && lens[order[b-1]] < lens[s]; b--) order[b] = order[b-1];
+            order[b] = s;
+        }
+        for (int a = 0; a < nSeries; a++) {
+            int s = order[a], best = -1;
+            for (int node = 0; node < ex.nNodes; node++) { // (nodes with no threads of ours get nothing)
+                if (nodeThreads[node] == 0) continue;
+                if (best < 0 || nodeWork[node] / nodeThreads[node] < nodeWork[best] / nodeThreads[best]) best = node;
+            }
+            ex.home[s] = best;
+            nodeWork[best] += fdRangeWork(lens[s], nw, 0, lens[s]);
+        }
+        free(order);
+        free(nodeWork);
+        free(nodeThreads);
+        
+        for (int node = 0; node < ex.nNodes; node++) atomic_init(&ex.nodeReady[node], 0);
+    }
+    
+    if (totalOutputs == 0) {
+        for (int s = 0; s < nSeries; s++) if (!out[s]) out[s] = calloc(lens[s], sizeof(float));
+    } else {
+        // deal the whole series out round robin among the deques on their home node,
+        // the first thread to get to a long one will start cutting it up
+        int * next = calloc(ex.nNodes, sizeof(int));
+        for (int s = 0; s < nSeries; s++) {
+            if (lens[s] == 0) {
+                if (!out[s]) out[s] = calloc(lens[s], sizeof(float));
+                continue;
+            }
+            int node = ex.nNodes > 1 ? ex.home[s] : 0;
+            int k = next[node];
+            while (ex.nNodes > 1 && ex.dequeNode[k % nThreads] != node) k++;
+            k %= nThreads;
+            fdDequePush(&ex.deques[k], (fdRange){s, 0, lens[s]});
+            next[node] = k + 1;
+        }
+        free(next);
+        
+        fdTaskGroup group = FD_TASK_GROUP_INIT;
+        for (int k = 0; k < nThreads; k++) fdPoolSubmit(pool, &group, fdStealLoop, &ex);
+        fdPoolWait(pool, &group);
+    }
+    
+    free(weights);
+    
+    for (int k = 0; k < nThreads; k++) {
+        pthread_mutex_destroy(&ex.deques[k].lock);
+        free(ex.deques[k].items);
+    }
+    free(ex.deques);
+    free(ex.dequeNode);
+    if (ex.nNodes > 1) {
+        for (int s = 0; s < nSeries; s++) free(ex.local[s]);
+        for (int node = 0; node < ex.nNodes; node++) free(ex.nodeWeights[node]);
+        free(ex.home);
+        free(ex.local);
+        free(ex.nodeWeights);
+        free(ex.nodeReady);
+    }
+    free(stealLens);
+    
+    return out;
+}
+
+// ----
+// Monte Carlo:  many simulated forecast paths back to levels at once
+
+// Risk envelopes simulate 10k-100k paths of h steps on the differenced scale, and every one has to go back to levels.
+// The history part of the levels is the same for all of them, so it comes from one fdForecastInverter (made once),
+// and each path only needs the short h step part:  levels = history + (Toeplitz matrix of V) x (the path's forecasts).
+// For all the paths at once that is a matrix product, done here a block of FD_PATH_BLOCK paths at a time:
+// the block is transposed to step-major order, so the innermost loop runs across paths (contiguous, SIMD friendly)
+// and each V[q] is loaded once for the whole block.  Blocks are spread over the default thread pool.
+// Each level is summed in the same order as fdForecastInvert(), and both are compiled with multiply-add fusing off
+// (FD_NO_FMA on gcc, the FP_CONTRACT pragma around each on clang), so the results are the same.
+
+// forecasts[path*h + s] is step s of path path (step order, as for fdForecastInvert), levels the same layout.
+// Only the first inv->horizon steps of each path can be inverted; if h is longer, the rows keep their stride h
+// and levels past the horizon are left as they were (as fdForecastInvert does).
+
+#define FD_PATH_BLOCK 16
+
+typedef struct {
+    const fdForecastInverter * inv;
+    const float * forecasts;
+    float * levels;
+    int h, steps;     // row stride, and steps to invert (up to the horizon)
+    int from, to;     // paths from .. to-1
+} fdPathTask;
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+FD_NO_FMA static void fdPathTaskRun(void * arg) {
+    
+    fdPathTask * t = arg;
+    int h = t->h, steps = t->steps;
+    const double * v = t->inv->v;
+    // [step][path in block]; zeroed so the unused lanes of a last partial block are summed from zeros
+    double * fc = calloc((size_t)steps * FD_PATH_BLOCK, sizeof(double));
+    double * sum = malloc(FD_PATH_BLOCK * sizeof(double));
+    
+    for (int p0 = t->from; p0 < t->to; p0 += FD_PATH_BLOCK) {
+        int np = t->to - p0 < FD_PATH_BLOCK ? t->to - p0 : FD_PATH_BLOCK;
+        
+        for (int p = 0; p < np; p++)
+            for (int s = 0; s < steps; s++) fc[s*FD_PATH_BLOCK + p] = t->forecasts[(size_t)(p0 + p)*h + s];
+        
+        for (int s = 0; s < steps; s++) {
+            for (int p = 0; p < FD_PATH_BLOCK; p++) sum[p] = t->inv->history[s];
+            for (int q = 0; q <= s; q++) {
+                double vq = v[q];
+                const double * f = fc + (s - q)*FD_PATH_BLOCK;
+                for (int p = 0; p < FD_PATH_BLOCK; p++) sum[p] += vq * f[p];
+            }
+            for (int p = 0; p < np; p++) t->levels[(size_t)(p0 + p)*h + s] = (float)sum[p];
+        }
+    }
+    
+    free(fc);
+    free(sum);
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT ON
+#endif
+
+void fdForecastInvertPaths(const fdForecastInverter * inv, const float * forecasts, int nPaths, int h, float * levels) {
+    
+    int steps = h < inv->horizon ? h : inv->horizon;
+    if (nPaths <= 0 || steps <= 0) return;
+    
+    fdPool * pool = fdDefaultPool();
+    int nThreads = fdPoolSize(pool) + 1;
+    int nBlocks = (nPaths + FD_PATH_BLOCK - 1) / FD_PATH_BLOCK;
+    int nTasks = nThreads == 1 ? 1 : 4 * nThreads < nBlocks ? 4 * nThreads : nBlocks;
+    int blocksPerTask = (nBlocks + nTasks - 1) / nTasks;
+    
+    fdPathTask * tasks = malloc(nTasks * sizeof(fdPathTask));
+    fdTaskGroup group = FD_TASK_GROUP_INIT;
+    int n = 0;
+    for (int b = 0; b < nBlocks; b += blocksPerTask) {
+        int to = (b + blocksPerTask) * FD_PATH_BLOCK;
+        tasks[n] = (fdPathTask){inv, forecasts, levels, h, steps, b * FD_PATH_BLOCK, to < nPaths ? to : nPaths};
+        if (nThreads == 1) fdPathTaskRun(&tasks[n]);
+        else fdPoolSubmit(pool, &group, fdPathTaskRun, &tasks[n]);
+        n++;
+    }
+    if (nThreads > 1) fdPoolWait(pool, &group);
+    
+    free(tasks);
+}
+
+// ----
+// Quantile envelopes across simulated paths, in one streaming pass
+
+// Probability envelopes (e.g. the 5/25/50/75/95 percentiles at each step ahead, as in the FEM projections of
+// MCarloRisk3D) normally mean keeping every path and sorting each step:  paths x horizon memory.
+// Here each step ahead gets a streaming quantile sketch instead, and the paths are fed through and dropped.
+
+// The sketch is the DDSketch idea:  values are counted in buckets whose edges are powers of gamma = (1+a)/(1-a),
+// so any quantile read back is within relative error a of a true sample value at that rank (a = 0.001 gives
+// quantiles within 0.1%).  The bucket count only grows with the log of the range of the values (about a thousand
+// buckets for prices that move by a factor of 10), not with the number of paths.  Negative values and zeros
+// get their own buckets, so differenced scale values work too.  Two sketches merge by adding bucket counts, which
+// gives exactly the sketch of all the values together, so each thread fills its own and they are merged at the end
+// (and the result doesn't depend on how the paths were split between threads).
+// If a store would go over FD_SKETCH_MAX_BINS buckets, its smallest-magnitude buckets are folded together
+// (only the accuracy of the very smallest values suffers).
+
+#define FD_SKETCH_MAX_BINS 4096
+
+typedef struct {
+    uint64_t * counts;  // counts[k - minKey] for bucket keys minKey .. minKey+n-1
+    int minKey, n;
+} fdSketchStore;
+
+typedef struct {
+    double lnGamma;
+    fdSketchStore pos, neg;
+    uint64_t zero, count;
+} fdSketch;
+
+static void fdSketchInit(fdSketch * sk, double accuracy) {
+    memset(sk, 0, sizeof(*sk));
+    sk->lnGamma = log((1 + accuracy) / (1 - accuracy));
+}
+
+static void fdSketchFree(fdSketch * sk) {
+    free(sk->pos.counts);
+    free(sk->neg.counts);
+}
+
+static void fdStoreAdd(fdSketchStore * st, int key, uint64_t c) {
+    
+    if (st->n == 0) {
+        st->counts = calloc(1, sizeof(uint64_t));
+        st->minKey = key;
+        st->n = 1;
+    } else if (key < st->minKey || key >= st->minKey + st->n) {
+        int lo = key < st->minKey ? key : st->minKey;
+        int hi = key >= st->minKey + st->n ? key + 1 : st->minKey + st->n;
+        if (hi - lo > FD_SKETCH_MAX_BINS) lo = hi - FD_SKETCH_MAX_BINS; // fold the smallest ones into bucket lo
+        uint64_t * grown = calloc(hi - lo, sizeof(uint64_t));
+        for (int k = 0; k < st->n; k++) {
+            int key2 = st->minKey + k;
+            grown[(key2 > lo ? key2 : lo) - lo] += st->counts[k];
+        }
+        free(st->counts);
+        st->counts = grown;
+        st->minKey = lo;
+        st->n = hi - lo;
+    }
+    if (key < st->minKey) key = st->minKey;
+    st->counts[key - st->minKey] += c;
+}
+
+static void fdSketchAdd(fdSketch * sk, double x) {
+    double m = fabs(x);
+    if (m < 1e-300 || x != x) sk->zero++; // (NaNs counted as zeros rather than breaking the bucket math)
+    else fdStoreAdd(x > 0 ? &sk->pos : &sk->neg, (int)ceil(log(m) / sk->lnGamma), 1);
+    sk->count++;
+}
+
+static void fdSketchMerge(fdSketch * dst, const fdSketch * src) {
+    for (int k = 0; k < src->pos.n; k++) if (src->pos.counts[k]) fdStoreAdd(&dst->pos, src->pos.minKey + k, src->pos.counts[k]);
+    for (int k = 0; k < src->neg.n; k++) if (src->neg.counts[k]) fdStoreAdd(&dst->neg, src->neg.minKey + k, src->neg.counts[k]);
+    dst->zero += src->zero;
+    dst->count += src->count;
+}
+
+// value at quantile q (0..1):  walk the buckets from the most negative value up to the one holding rank q*(count-1)
+
+static double fdSketchQuantile(const fdSketch * sk, double q) {
+    
+    if (sk->count == 0) return NAN;
+    double rank = q * (sk->count - 1);
+    double gamma = exp(sk->lnGamma);
+    uint64_t seen = 0;
+    
+    for (int k = sk->neg.n - 1; k >= 0; k--) {
+        seen += sk->neg.counts[k];
+        if (seen > rank) return -2 * exp((sk->neg.minKey + k) * sk->lnGamma) / (gamma + 1);
+    }
+    seen += sk->zero;
+    if (seen > rank) return 0;
+    for (int k = 0; k < sk->pos.n; k++) {
+        seen += sk->pos.counts[k];
+        if (seen > rank) return 2 * exp((sk->pos.minKey + k) * sk->lnGamma) / (gamma + 1);
+    }
+    return 2 * exp((sk->pos.minKey + sk->pos.n - 1) * sk->lnGamma) / (gamma + 1);
+}
+
+// The paths come from a callback, so they never all have to exist at once:  source(ctx, path, values) fills
+// values[0 .. h-1] for that path (step order).  It is called from several threads at once for different paths,
+// so it has to be thread safe (e.g. a counter based random number generator keyed on the path number).
+// With an inverter, the values are forecasts on the differenced scale and go through fdForecastInvert() first
+// (the "fused" stage:  generate, integrate back to levels, sketch, drop); with inv = NULL they are used as they are.
+// envelopes[k*h + s] = quantile quantiles[k] at step s.  accuracy is the relative accuracy a above (0 = 0.001).
+// The source always fills all h values, but with an inverter only the first inv->horizon steps can be turned into
+// levels:  if h is longer, the envelopes past the horizon are NaN (the layout still has stride h).
+// Note the accuracy is relative to the level itself:  for prices around 100 with a 1% wide envelope,
+// a = 0.005 would only resolve the envelope to +/- 0.5, so keep a well below the relative width of the envelope.
+
+typedef void (*fdPathSource)(void * ctx, long path, float * values);
+
+typedef struct {
+    const fdForecastInverter * inv;
+    fdPathSource source;
+    void * ctx;
+    int h, steps;         // values per path, and steps sketched (up to the inverter's horizon)
+    long from, to;
+    fdSketch * sketches;  // steps of them, this task's own
+} fdEnvelopeTask;
+
+static void fdEnvelopeTaskRun(void * arg) {
+    fdEnvelopeTask * t = arg;
+    float * values = malloc(t->h * sizeof(float));
+    float * levels = t->inv ? malloc(t->steps * sizeof(float)) : values;
+    for (long p = t->from; p < t->to; p++) {
+        t->source(t->ctx, p, values);
+        if (t->inv) fdForecastInvert(t->inv, values, t->steps, levels);
+        for (int s = 0; s < t->steps; s++) fdSketchAdd(&t->sketches[s], levels[s]);
+    }
+    if (levels != values) free(levels);
+    free(values);
+}
+
+void fdQuantileEnvelopes(const fdForecastInverter * inv, fdPathSource source, void * ctx, long nPaths, int h,
+                         const double * quantiles, int nQuantiles, double accuracy, float * envelopes) {
+    
+    if (h <= 0) return;
+    int steps = inv && h > inv->horizon ? inv->horizon : h;
+    for (int s = steps; s < h; s++)
+        for (int q = 0; q < nQuantiles; q++) envelopes[q*h + s] = NAN;
+    if (steps <= 0) return;
+    if (accuracy <= 0 || accuracy >= 1) accuracy = 0.001;
+    
+    fdPool * pool = fdDefaultPool();
+    int nTasks = fdPoolSize(pool) + 1; // one set of sketches per thread
+    if (nPaths < nTasks) nTasks = nPaths > 0 ? (int)nPaths : 1;
+    
+    fdEnvelopeTask * tasks = malloc(nTasks * sizeof(fdEnvelopeTask));
+    fdTaskGroup group = FD_TASK_GROUP_INIT;
+    for (int k = 0; k < nTasks; k++) {
+        tasks[k] = (fdEnvelopeTask){inv, source, ctx, h, steps, nPaths * k / nTasks, nPaths * (k + 1) / nTasks, malloc(steps * sizeof(fdSketch))};
+        for (int s = 0; s < steps; s++) fdSketchInit(&tasks[k].sketches[s], accuracy);
+        if (k > 0) fdPoolSubmit(pool, &group, fdEnvelopeTaskRun, &tasks[k]);
+    }
+    fdEnvelopeTaskRun(&tasks[0]); // the calling thread does a share too
+    fdPoolWait(pool, &group);
+    
+    for (int k = 1; k < nTasks; k++)
+        for (int s = 0; s < steps; s++) {
+            fdSketchMerge(&tasks[0].sketches[s], &tasks[k].sketches[s]);
+            fdSketchFree(&tasks[k].sketches[s]);
+        }
+    
+    for (int s = 0; s < steps; s++) {
+        for (int q = 0; q < nQuantiles; q++) envelopes[q*h + s] = (float)fdSketchQuantile(&tasks[0].sketches[s], quantiles[q]);
+        fdSketchFree(&tasks[0].sketches[s]);
+    }
+    
+    for (int k = 0; k < nTasks; k++) free(tasks[k].sketches);
+    free(tasks);
+}
+
+// ----
+// ARFIMA path generator
+
+// Synthetic long memory paths:  draw noise, run it through an ARMA filter, then fractionally integrate it,
+// x = (1-B)^(-d) ARMA(noise), which is what fracDiff(noise, len, -d, 0, 0) does for the last step.
+// Done path by path with fracDiff that is O(n^2) per path on one thread.  Here:
+// - the random numbers come from a counter based generator (Philox4x32-10):  the numbers for path p are a pure
+//   function of (seed, p, position), so any path can be made on any thread in any order and always comes out the same,
+//   and paths can be handed out to threads freely.  Draws are Gaussian (Box-Muller) or, for FEM style
+//   empirical noise, resampled (bootstrap) from a given set of innovations.
+// - the fractional integration is an FFT convolution with the -d weights, whose transform is worked out once when
+//   the generator is made and reused for every path:  O(n log n) per path.  The filter is real, so two paths
+//   go through one complex FFT (one in the real part, one in the imaginary part) and come out the same way.
+//   Paths are always paired (2m, 2m+1), so a path's values don't depend on which other paths were asked for.
+// - paths are spread over the default thread pool.
+
+// Paths come out most recent first, like the rest of the library (out[len-1] is the first value generated).
+// ar[0..p-1], ma[0..q-1] are the ARMA coefficients:  v[t] = e[t] + ma[0] e[t-1] + ... + ar[0] v[t-1] + ...
+// (p = q = 0 for plain fractionally integrated noise).  Everything starts from zero before the first value, the same
+// finite-history edge as fracDiff.
+
+typedef struct {
+    float d;
+    int len, n;             // path length, FFT size
+    double * wre, * wim;    // transform of the -d weights
+    double * ar, * ma;
+    int p, q;
+    double sigma;
+    uint64_t seed;
+    const float * bootstrap;
+    int nBootstrap;
+} fdArfima;
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers:  as easy as 1, 2, 3"), in place on ctr
+
+static void fdPhilox(uint32_t ctr[4], uint64_t seed) {
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    for (int r = 0; r < 10; r++) {
+        if (r > 0) {
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        uint64_t p0 = (uint64_t)0xD2511F53 * ctr[0];
+        uint64_t p1 = (uint64_t)0xCD9E8D57 * ctr[2];
+        uint32_t c1 = ctr[1], c3 = ctr[3];
+        ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        ctr[1] = (uint32_t)p1;
+        ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        ctr[3] = (uint32_t)p0;
+    }
+}
+
+fdArfima * fdArfimaCreate(float d, int len, const double * ar, int p, const double * ma, int q, double sigma, uint64_t seed) {
+    
+    fdArfima * g = calloc(1, sizeof(fdArfima));
+    g->d = d;
+    g->len = len > 0 ? len : 1;
+    g->n = fdNextPow2(2 * g->len);
+    g->p = p > 0 ? p : 0;
+    g->q = q > 0 ? q : 0;
+    g->ar = malloc((g->p + 1) * sizeof(double));
+    g->ma = malloc((g->q + 1) * sizeof(double));
+    if (g->p) memcpy(g->ar, ar, g->p * sizeof(double));
+    if (g->q) memcpy(g->ma, ma, g->q * sizeof(double));
+    g->sigma = sigma;
+    g->seed = seed;
+    
+    g->wre = calloc(g->n, sizeof(double));
+    g->wim = calloc(g->n, sizeof(double));
+    g->wre[0] = 1;
+    for (int k = 1; k < g->len; k++) g->wre[k] = (-g->wre[k-1]*(-(double)d-k+1))/k; // recurrence [A] with -d, in double
+    fdFFT(g->wre, g->wim, g->n, 0);
+    
+    return g;
+}
+
+// draw from innovations[0 .. n-1] (with replacement) instead of the Gaussian; the array must outlive the generator
+
+void fdArfimaSetBootstrap(fdArfima * g, const float * innovations, int n) {
+    g->bootstrap = n > 0 ? innovations : NULL;
+    g->nBootstrap = n;
+}
+
+void fdArfimaDestroy(fdArfima * g) {
+    if (!g) return;
+    free(g->wre);
+    free(g->wim);
+    free(g->ar);
+    free(g->ma);
+    free(g);
+}
+
+// the ARMA filtered noise of a path, in time order (oldest first)
+
+static void fdArfimaNoise(const fdArfima * g, long path, double * v) {
+    
+    for (int t = 0; t < g->len; t += 2) {
+        uint32_t c[4] = {(uint32_t)(t / 2), 0, (uint32_t)path, (uint32_t)((uint64_t)path >> 32)};
+        fdPhilox(c, g->seed);
+        if (g->bootstrap) {
+            v[t] = g->bootstrap[((uint64_t)c[0] * g->nBootstrap) >> 32];
+            if (t + 1 < g->len) v[t+1] = g->bootstrap[((uint64_t)c[1] * g->nBootstrap) >> 32];
+        } else {
+            double u1 = (c[0] + 0.5) / 4294967296.0, u2 = (c[1] + 0.5) / 4294967296.0;  // in (0,1)
+            double r = g->sigma * sqrt(-2 * log(u1));
+            v[t] = r * cos(2*M_PI*u2);
+            if (t + 1 < g->len) v[t+1] = r * sin(2*M_PI*u2);
+        }
+    }
+    
+    if (g->q) { // MA part, newest first so the e's it needs are still untouched
+        for (int t = g->len - 1; t > 0; t--)
+            for (int j = 1; j <= g->q && j <= t; j++) v[t] += g->ma[j-1] * v[t-j];
+    }
+    if (g->p) {
+        for (int t = 1; t < g->len; t++)
+            for (int i = 1; i <= g->p && i <= t; i++) v[t] += g->ar[i-1] * v[t-i];
+    }
+}
+
+// paths 2m and 2m+1 together (either output may be NULL); gen is the fdArfima, as an fdPairFn
+
+static void fdArfimaPair(const void * gen, long m, float * outEven, float * outOdd) {
+    
+    const fdArfima * g = gen;
+    int n = g->n, len = g->len;
+    double * re = calloc(n, sizeof(double));
+    double * im = calloc(n, sizeof(double));
+    fdArfimaNoise(g, 2*m, re);
+    fdArfimaNoise(g, 2*m + 1, im);
+    
+    fdFFT(re, im, n, 0);
+    for (int k = 0; k < n; k++) {
+        double a = re[k], b = im[k];
+        re[k] = a*g->wre[k] - b*g->wim[k];
+        im[k] = a*g->wim[k] + b*g->wre[k];
+    }
+    fdFFT(re, im, n, 1);
+    
+    for (int t = 0; t < len; t++) {
+        if (outEven) outEven[len-1-t] = (float)(re[t] / n);
+        if (outOdd) outOdd[len-1-t] = (float)(im[t] / n);
+    }
+    
+    free(re);
+    free(im);
+}
+
+// one path, len values
+
+void fdArfimaPath(const fdArfima * g, long path, float * out) {
+    fdArfimaPair(g, path / 2, path % 2 ? NULL : out, path % 2 ? out : NULL);
+}
+
+// Both path generators (this one and fdFgn below) make paths in pairs (2m, 2m+1) with one complex FFT, so they
+// share the code that hands pairs out to the pool:  fn(gen, m, outEven, outOdd) makes pair m.
+
+typedef void (*fdPairFn)(const void * gen, long pair, float * outEven, float * outOdd);
+
+typedef struct {
+    const void * gen;
+    fdPairFn fn;
+    int len;
+    long first, from, to;  // pairs from .. to-1, of the paths first .. first+nPaths-1
+    long nPaths;
+    float * out;
+} fdPairTask;
+
+static void fdPairTaskRun(void * arg) {
+    fdPairTask * t = arg;
+    for (long m = t->from; m < t->to; m++) {
+        long even = 2*m - t->first, odd = even + 1;  // positions in out
+        t->fn(t->gen, m, even >= 0 ? t->out + even * t->len : NULL, odd < t->nPaths ? t->out + odd * t->len : NULL);
+    }
+}
+
+// paths firstPath .. firstPath+nPaths-1 (len values each) into out[k*len .. (k+1)*len-1], spread over the pool
+
+static void fdPairsOnPool(const void * gen, fdPairFn fn, int len, long firstPath, long nPaths, float * out) {
+    
+    if (nPaths <= 0) return;
+    long m0 = firstPath / 2, m1 = (firstPath + nPaths - 1) / 2 + 1; // pairs to do
+    
+    fdPool * pool = fdDefaultPool();
+    int nThreads = fdPoolSize(pool) + 1;
+    long nTasks = 4 * nThreads < m1 - m0 ? 4 * nThreads : m1 - m0;
+    
+    fdPairTask * tasks = malloc(nTasks * sizeof(fdPairTask));
+    fdTaskGroup group = FD_TASK_GROUP_INIT;
+    for (long k = 0; k < nTasks; k++) {
+        tasks[k] = (fdPairTask){gen, fn, len, firstPath, m0 + (m1 - m0) * k / nTasks, m0 + (m1 - m0) * (k + 1) / nTasks, nPaths, out};
+        if (k > 0) fdPoolSubmit(pool, &group, fdPairTaskRun, &tasks[k]);
+    }
+    fdPairTaskRun(&tasks[0]);
+    fdPoolWait(pool, &group);
+    
+    free(tasks);
+}
+
+// paths firstPath .. firstPath+nPaths-1 into out[k*len .. (k+1)*len-1], spread over the pool
+
+void fdArfimaPaths(const fdArfima * g, long firstPath, long nPaths, float * out) {
+    fdPairsOnPool(g, fdArfimaPair, g->len, firstPath, nPaths, out);
+}
+
+// ----
+// Exact fractional Gaussian noise (Davies-Harte / circulant embedding)
+
+// For the Gaussian case of FBM (see the notes at the top), fractional Gaussian noise (the increments of FBM) with Hurst
+// exponent H can be made exactly, not just approximately like inverse filtering white noise with fracDiff
+// (whose truncated weights get the covariance wrong near the start of the path).
+// The covariance of unit variance fGn at lag k is
+// g(k) = ( |k+1|^2H - 2|k|^2H + |k-1|^2H ) / 2
+// Wrapping g around a circle of size M >= 2(n-1) makes a circulant covariance matrix, which the FFT diagonalizes:
+// its eigenvalues are the FFT of the wrapped g, and they are all >= 0 for fGn with 0 < H < 1.  Then with xi complex
+// Gaussian (independent N(0,1) real and imaginary parts), FFT(sqrt(eigenvalue / M) * xi) has the exact fGn covariance
+// in both its real and its imaginary part, independently.  So each FFT of size M gives two exact paths:  O(n log n)
+// per path.  M is a power of 2 (fdFFT is radix 2).
+
+// The eigenvalues only depend on (H, n), so they are worked out once when the generator is made, and kept for all
+// the paths it makes.  Make one generator per (H, n) and reuse it.
+// Random numbers are Philox (see the ARFIMA generator) keyed on (seed, path pair), so paths are reproducible by
+// number, whatever thread makes them; paths are paired (2m, 2m+1) as there.
+// Paths come out most recent first, like the rest of the library.  For FBM itself, take the running sum
+// (fracDiff with d = -1, which is O(n)).
+
+// Hurst exponent and d:  fractionally integrated noise with d has the same long memory (autocorrelation decaying
+// like k^(2d-1) = k^(2H-2)) as fGn with H = d + 1/2.  So H = 0.5 (no memory) is d = 0, persistent H > 0.5 is d > 0.
+
+double fdHurstToD(double H) {
+    return H - 0.5;
+}
+
+double fdDToHurst(double d) {
+    return d + 0.5;
+}
+
+typedef struct {
+    double H, sigma;
+    int len, m;          // path length, circulant size
+    double * scale;      // sqrt(eigenvalue / m) for each frequency
+    uint64_t seed;
+} fdFgn;
+
+// NULL unless 0 < H < 1:  at H = 1 every value of a path would be the same, and outside 0..1 the formula above
+// is not a covariance at all (the eigenvalues go negative), so there is no fGn to make.
+
+fdFgn * fdFgnCreate(double H, int len, double sigma, uint64_t seed) {
+    
+    if (!(H > 0 && H < 1)) return NULL;
+    
+    fdFgn * g = calloc(1, sizeof(fdFgn));
+    g->H = H;
+    g->sigma = sigma;
+    g->len = len > 0 ? len : 1;
+    g->seed = seed;
+    int m = fdNextPow2(2 * (g->len - 1));
+    if (m < 2) m = 2;
+    g->m = m;
+    
+    // wrapped autocovariance, then its FFT (real and even, so the eigenvalues are the real parts)
+    double * re = calloc(m, sizeof(double));
+    double * im = calloc(m, sizeof(double));
+    for (int k = 0; k <= m/2; k++) {
+        double gk = 0.5 * (pow(k + 1, 2*H) - 2 * pow(k, 2*H) + pow(abs(k - 1), 2*H));
+        re[k] = gk;
+        if (k > 0 && k < m/2) re[m-k] = gk;
+    }
+    fdFFT(re, im, m, 0);
+    
+    g->scale = malloc(m * sizeof(double));
+    for (int k = 0; k < m; k++) g->scale[k] = sigma * sqrt((re[k] > 0 ? re[k] : 0) / m); // round-off can give tiny negatives
+    
+    free(re);
+    free(im);
+    return g;
+}
+
+void fdFgnDestroy(fdFgn * g) {
+    if (!g) return;
+    free(g->scale);
+    free(g);
+}
+
+// paths 2p and 2p+1 together (either output may be NULL); gen is the fdFgn, as an fdPairFn
+
+static void fdFgnPair(const void * gen, long pair, float * outEven, float * outOdd) {
+    
+    const fdFgn * g = gen;
+    int m = g->m, len = g->len;
+    double * re = malloc(m * sizeof(double));
+    double * im = malloc(m * sizeof(double));
+    
+    for (int k = 0; k < m; k++) {
+        uint32_t c[4] = {(uint32_t)k, 1, (uint32_t)pair, (uint32_t)((uint64_t)pair >> 32)}; // c[1] = 1 keeps these apart from ARFIMA's
+        fdPhilox(c, g->seed);
+        double u1 = (c[0] + 0.5) / 4294967296.0, u2 = (c[1] + 0.5) / 4294967296.0;
+        double r = g->scale[k] * sqrt(-2 * log(u1));
+        re[k] = r * cos(2*M_PI*u2);
+        im[k] = r * sin(2*M_PI*u2);
+    }
+    
+    fdFFT(re, im, m, 0);
+    
+    for (int t = 0; t < len; t++) {
+        if (outEven) outEven[len-1-t] = (float)re[t];
+        if (outOdd) outOdd[len-1-t] = (float)im[t];
+    }
+    
+    free(re);
+    free(im);
+}
+
+void fdFgnPath(const fdFgn * g, long path, float * out) {
+    fdFgnPair(g, path / 2, path % 2 ? NULL : out, path % 2 ? out : NULL);
+}
+
+// paths firstPath .. firstPath+nPaths-1 into out[k*len .. (k+1)*len-1], spread over the pool
+
+void fdFgnPaths(const fdFgn * g, long firstPath, long nPaths, float * out) {
+    fdPairsOnPool(g, fdFgnPair, g->len, firstPath, nPaths, out);
+}
+
+// ----
+// Missing data (gaps, halts):  fracDiff with a validity mask
+
+// With plain fracDiff a single NaN in the series makes every output whose window reaches it NaN
+// (NaN times a weight is NaN, and NaN plus anything is NaN), which with full memory weights is every
+// output from the NaN forward in time.  fracDiffMasked() takes a validity bitmap instead, and deals with
+// the missing values inside the dot product loop according to a policy:
+
+// FD_NAN_PROPAGATE:  an output is NaN if any value in its window is missing (what plain fracDiff does, but without
+//                    needing the NaNs in the data)
+// FD_NAN_SKIP:       missing values are left out, and the remaining lagged weights are scaled up so they add up to
+//                    the same total as all the lagged weights, i.e. skip and renormalize.  (The lagged weights are all
+//                    the same sign for 0 < d < 1, so this is well behaved there.  Renormalizing the absolute weights
+//                    instead would not work for differencing:  with d = 1 and the previous value missing, it would
+//                    give 2 * x[i] instead of an unknown difference.)  The output is NaN if the current value itself
+//                    is missing, or if none of the lagged values in the window are there.
+// FD_NAN_CARRY:      a missing value is replaced by the last value before it in time (carry forward, what a
+//                    forward-filled resample would do).  Missing values at the very start of the history have nothing
+//                    to carry, and are skipped as in FD_NAN_SKIP.
+
+// valid is a bitmap:  bit (j % 8) of byte valid[j / 8] is 1 if series[j] is there.
+// If valid is NULL, the NaNs in the series are taken as the missing values.
+
+// How it works:  outputs are done from the oldest to the newest, and just before output i, position i of two work
+// arrays is filled in:  the value to use (0 if missing, or the carried value) and a 1/0 flag for "there is a value".
+// Both are computed with bit masks and arithmetic, not branches.  The dot product loop then sums value * weight,
+// flag * weight, weight, and 1 - flag, in the same FD_LANES lane pattern as the deterministic mode above
+// (so it vectorizes), and the policy is applied to those four sums.  There is no separate pass over the data
+// to find or fill the gaps.
+
+// When nothing is missing, the result is the same as fracDiff() in deterministic mode (fdSetDeterministic(1)),
+// and the same as plain fracDiff() up to the last bit or so of rounding.
+
+#define FD_NAN_PROPAGATE 0
+#define FD_NAN_SKIP      1
+#define FD_NAN_CARRY     2
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+// sums[0] = sum of value * weight, sums[1] = sum of flag * weight, sums[2] = sum of weight, sums[3] = number missing
+
+FD_NO_FMA static void fdMaskedDot(const float * vals, const float * ok, const float * w, int n, float * sums) {
+    
+    float tot[FD_LANES] = {0}, okw[FD_LANES] = {0}, allw[FD_LANES] = {0}, miss[FD_LANES] = {0};
+    int j = 0;
+    
+    for (; j + FD_LANES <= n; j += FD_LANES)
+        for (int k = 0; k < FD_LANES; k++) {
+            tot[k]  += vals[j+k] * w[j+k];
+            okw[k]  += ok[j+k] * w[j+k];
+            allw[k] += w[j+k];
+            miss[k] += 1 - ok[j+k];
+        }
+    for (int k = 0; j < n; j++, k++) {
+        tot[k]  += vals[j] * w[j];
+        okw[k]  += ok[j] * w[j];
+        allw[k] += w[j];
+        miss[k] += 1 - ok[j];
+    }
+    
+    for (int width = FD_LANES/2; width > 0; width /= 2)
+        for (int k = 0; k < width; k++) {
+            tot[k]  += tot[k + width];
+            okw[k]  += okw[k + width];
+            allw[k] += allw[k + width];
+            miss[k] += miss[k + width];
+        }
+    
+    sums[0] = tot[0];
+    sums[1] = okw[0];
+    sums[2] = allw[0];
+    sums[3] = miss[0];
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT ON
+#endif
+
+// Returns a calloc'd array of len outputs, caller must free().  Other arguments as for fracDiff().
+
+float * fracDiffMasked(float * series, int len, const unsigned char * valid, float d, float threshold, int useNWeights, int policy) {
+    
+    float * df_temp = calloc(len, sizeof(float)); // for output
+    if (len <= 0) return df_temp;
+    
+    float * weights = findWeights_ffd(d, len, threshold, useNWeights);
+    int nw = fdCountWeights(weights, len);
+    
+    float * vals = malloc(len * sizeof(float)); // value to use at each position
+    float * ok = malloc(len * sizeof(float));   // 1 if there is a value there, else 0
+    float carry = 0, carryOk = 0;
+    
+    for (int i = len - 1; i >= 0; i--) {
+        
+        // is series[i] there?  (x == x is false only for NaN)
+        uint32_t m = valid ? (valid[i >> 3] >> (i & 7)) & 1 : series[i] == series[i];
+        
+        // zero the value if it's missing, by masking the bits (multiplying a NaN by 0 would still give NaN)
+        uint32_t bits;
+        float x;
+        memcpy(&bits, &series[i], sizeof(bits));
+        bits &= 0u - m;
+        memcpy(&x, &bits, sizeof(x));
+        
+        if (policy == FD_NAN_CARRY) {
+            // carry stays finite (it only ever holds masked values), so (1-m)*carry is 0 or carry
+            carry = x + (1 - m) * carry;
+            carryOk = m + (1 - m) * carryOk;
+            vals[i] = carry;
+            ok[i] = carryOk;
+        } else {
+            vals[i] = x;
+            ok[i] = m;
+        }
+        
+        int n = len - i < nw ? len - i : nw;
+        float sums[4];
+        fdMaskedDot(vals + i, ok + i, weights, n, sums);
+        
+        float head = vals[i] * weights[0];
+        float okLag = sums[1] - ok[i] * weights[0]; // lagged weights that have values
+        float allLag = sums[2] - weights[0];        // all lagged weights
+        float out;
+        
+        if (sums[3] == 0) out = sums[0];                  // nothing missing in the window
+        else if (policy == FD_NAN_PROPAGATE || ok[i] == 0) out = NAN;
+        else if (okLag != 0) out = head + (sums[0] - head) * (allLag / okLag);
+        else out = allLag == 0 ? head : NAN;             // no lagged values left to difference against
+        
+        df_temp[i] = out;
+    }
+    
+    free(vals);
+    free(ok);
+    free(weights);
+    
+    return df_temp;
+}
+
+// ----
+// Irregular timestamps (e.g. ticks), without resampling to a regular grid
+
+// The usual way to use fracDiff on ticks is to resample them to a regular grid, forward filling the gaps,
+// which can make the series 10-50 times longer.  But the forward filled grid is just each tick's value
+// repeated, so the weights of the repeats can be added up ahead of time and applied to the tick itself:
+// if tick j's value fills lags a+1 .. b (in grid steps back from the output's time), its weight is
+// w[a+1] + ... + w[b] = S(b) - S(a), where S(n) = w[0] + ... + w[n] is the running sum of the weights.
+
+// S has a closed form:  the weights are the power series coefficients of (1-z)^d, dividing by (1-z) gives the
+// running sums, and (1-z)^d / (1-z) = (1-z)^(d-1), so S(n) is the n-th coefficient of (1-z)^(d-1):
+// S(n) = gamma(n + 1 - d) / (gamma(1 - d) * gamma(n + 1))
+// This works for any real lag n, not just whole grid steps, so it also gives a variable step
+// Grunwald-Letnikov style fractional difference for ticks that are not on any grid.
+
+// So each output only needs one S() per tick in its window, and when the ticks are on a grid (timestamps that are
+// whole multiples of step) the result is the same as forward fill resampling + fracDiff() + picking out the outputs
+// at the tick times (up to float rounding).
+
+// Speed:  S at the whole lags 0, 1, 2, ... is just recurrence [A] run with d-1, so it is tabulated once up front, and
+// for ticks on the grid each term is a table lookup and a multiply-add, about the cost of the regular grid kernel per
+// tick (and there are fewer ticks than grid points).  The table covers lags out to the oldest tick, up to
+// FD_IRREGULAR_TABLE entries per tick (at least 64k, at most 4M entries, 8 bytes each).
+
+// Ticks off the grid, or lags past the end of the table (ms timestamps over a trading day are lags in the tens of
+// millions), can't use the whole lag table.  The closed form is three lgamma() calls, far too slow to do per term,
+// so for lags of 1 and up S is tabulated a second time, on a log spaced grid:  the lags where the top
+// FD_IRREGULAR_GRID_BITS bits of the double's mantissa change, 2^FD_IRREGULAR_GRID_BITS points per doubling of the lag.
+// The slot of a lag is then just the top bits of the double (no log() needed), and S is interpolated linearly
+// between the two ends of the slot.  S is close to a power of the lag, so the relative error of that is about
+// d(d+1)/8 * 2^(-2*FD_IRREGULAR_GRID_BITS), below float resolution, at any lag.  The grid only goes out to the
+// longest lag, a few thousand closed form S() per doubling, made once.  Per term that is a couple of multiply-adds and
+// a lookup, in double, instead of three lgamma() calls.  Measured on one x86 host with 5000 to 20000 ms ticks over
+// a 6.5 hour session, against applyFilter() with the regular weights already made (which vectorizes in float):
+// about 3.5-5x its time at -O2, about 2x at -O3 -march=native.
+// Off grid lags below 1 (ticks closer together than step) get the closed form, memoized by lag, since the same
+// few small gaps tend to come up over and over.
+// Whole d > 0 has S nonzero at a few whole lags only (nothing to interpolate), so those use the memoized closed form.
+
+// table entries per tick, see above
+#define FD_IRREGULAR_TABLE 64
+
+// log grid points per doubling of the lag, as a power of 2
+#define FD_IRREGULAR_GRID_BITS 11
+
+typedef struct {
+    const double * table;   // S at whole lags 0 .. nTable-1
+    int nTable;
+    double d;
+    
+    // the log grid:  slot k covers the lags whose top mantissa bits (with the exponent) are key0 + k
+    double * grid;          // S = grid[2k] + tau * grid[2k+1] across slot k (the line through S at the slot's two ends)
+    uint64_t key0;
+    long nSlots;
+    
+    // memoized closed form, for the small off grid lags
+    double * cacheLag;
+    double * cacheValue;
+    int cacheMask;
+} fdLagS;
+
+static uint64_t fdLagKey(double tau) {
+    uint64_t bits;
+    memcpy(&bits, &tau, sizeof(bits));
+    return bits >> (52 - FD_IRREGULAR_GRID_BITS);
+}
+
+static double fdKeyLag(uint64_t key) {
+    uint64_t bits = key << (52 - FD_IRREGULAR_GRID_BITS);
+    double tau;
+    memcpy(&tau, &bits, sizeof(tau));
+    return tau;
+}
+
+static void fdLagSInit(fdLagS * L, const double * table, int nTable, double d, double maxLag) {
+    
+    memset(L, 0, sizeof(*L));
+    L->table = table;
+    L->nTable = nTable;
+    L->d = d;
+    
+    int size = 1 << 12;
+    L->cacheMask = size - 1;
+    L->cacheLag = malloc(size * sizeof(double));
+    L->cacheValue = malloc(size * sizeof(double));
+    for (int k = 0; k < size; k++) L->cacheLag[k] = NAN; // NaN never equals any lag, so all slots start empty
+    
+    if ((d > 0 && d == floor(d)) || !(maxLag >= 1)) return;
+    
+    L->key0 = fdLagKey(1);
+    L->nSlots = (long)(fdLagKey(maxLag * (1 + 1e-9)) - L->key0) + 1; // a little over, for round-off in the lags
+    L->grid = malloc(2 * L->nSlots * sizeof(double));
+    double lo = 1, sLo = fdCumWeight(d, lo);
+    for (long k = 0; k < L->nSlots; k++) {
+        double hi = fdKeyLag(L->key0 + k + 1), sHi = fdCumWeight(d, hi);
+        double slope = (sHi - sLo) / (hi - lo);
+        L->grid[2*k] = sLo - lo * slope; // no cancellation to speak of:  lo * slope is about -d * sLo
+        L->grid[2*k+1] = slope;
+        lo = hi;
+        sLo = sHi;
+    }
+}
+
+static void fdLagSFree(fdLagS * L) {
+    free(L->grid);
+    free(L->cacheLag);
+    free(L->cacheValue);
+}
+
+// S at lag tau from the log grid (1 <= tau <= the longest lag)
+
+static inline double fdLagGrid(const fdLagS * L, double tau) {
+    const double * g = L->grid + 2 * (fdLagKey(tau) - L->key0);
+    return g[0] + tau * g[1];
+}
+
+// S at lag tau:  from the whole lag table for whole lags (allowing for round-off in times / step), the log grid for
+// other lags of 1 and up, the memoized closed form otherwise
+
+static inline double fdLagCumWeight(fdLagS * L, double tau) {
+    
+    double n = floor(tau + 0.5);
+    if (n < L->nTable && fabs(tau - n) <= 1e-9 * (n + 1)) return L->table[(int)n];
+    
+    if (tau >= 1 && L->nSlots > 0 && fdLagKey(tau) - L->key0 < (uint64_t)L->nSlots) return fdLagGrid(L, tau);
+    
+    uint64_t bits;
+    memcpy(&bits, &tau, sizeof(bits));
+    int slot = (int)((bits * 0x9e3779b97f4a7c15ull) >> 40) & L->cacheMask;
+    if (L->cacheLag[slot] != tau) {
+        L->cacheLag[slot] = tau;
+        L->cacheValue[slot] = fdCumWeight(L->d, tau);
+    }
+    return L->cacheValue[slot];
+}
+
+// series[i] is the value of the tick at times[i], most recent first (so times decrease with i), same layout as fracDiff().
+// step is the grid step the lags are measured in (e.g. 1 for timestamps in seconds and a 1 second grid).
+// useNWeights = 0 uses all earlier ticks, useNWeights > 0 only the last useNWeights ticks (including the current one).
+// Returns a calloc'd array of len outputs, one per tick, caller must free().
+
+float * fracDiffIrregular(float * series, const double * times, int len, double step, float d, int useNWeights) {
+    
+    float * df_temp = calloc(len, sizeof(float)); // for output
+    if (len <= 0) return df_temp;
+    
+    int nw = useNWeights > 0 && useNWeights < len ? useNWeights : len;
+    
+    // S at the whole lags out to the oldest tick (or the size limit):  recurrence [A] with d-1, in double
+    double maxLag = (times[0] - times[len-1]) / step;
+    double limit = (double)FD_IRREGULAR_TABLE * len;
+    if (limit < (1 << 16)) limit = 1 << 16;
+    if (limit > (1 << 22)) limit = 1 << 22;
+    int nTable = maxLag + 2 < limit ? (int)maxLag + 2 : (int)limit;
+    if (nTable < 1) nTable = 1;
+    double * table = malloc(nTable * sizeof(double));
+    table[0] = 1;
+    for (int k = 1; k < nTable; k++) table[k] = (-table[k-1]*((double)d-1-k+1))/k;
+    
+    // all the ticks on the grid (and within the table):  whole number positions, and then every S is a table lookup
+    int * pos = malloc(len * sizeof(int));
+    int onGrid = maxLag >= 0 && maxLag + 1 < nTable;
+    for (int j = 0; j < len && onGrid; j++) {
+        double u = (times[j] - times[len-1]) / step, n = floor(u + 0.5);
+        pos[j] = (int)n;
+        if (fabs(u - n) > 1e-9 * (n + 1)) onGrid = 0;
+    }
+    
+    if (onGrid) {
+        // summing by parts:  sum of x[j] (S[j] - S[j-1]) = sum of S[j] (x[j] - x[j+1]), plus S x at the window's end,
+        // so the inner loop is one lookup and one multiply-add per tick (4 running sums to keep the adds flowing)
+        double * dx = malloc(len * sizeof(double));
+        for (int j = 0; j < len - 1; j++) dx[j] = (double)series[j] - series[j+1];
+        for (int i = 0; i < len; i++) {
+            int end = len - i < nw ? len : i + nw;
+            const double * S = table + pos[i]; // S[-pos[j]] = S at the lag from tick j to tick i
+            double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            int j = i;
+            for (; j + 4 <= end - 1; j += 4) {
+                s0 += S[-pos[j]] * dx[j];
+                s1 += S[-pos[j+1]] * dx[j+1];
+                s2 += S[-pos[j+2]] * dx[j+2];
+                s3 += S[-pos[j+3]] * dx[j+3];
+            }
+            for (; j < end - 1; j++) s0 += S[-pos[j]] * dx[j];
+            df_temp[i] = (s0 + s1) + (s2 + s3) + S[-pos[end-1]] * series[end-1];
+        }
+        free(dx);
+    } else {
+        fdLagS L;
+        fdLagSInit(&L, table, nTable, d, maxLag);
+        
+        double perStep = 1 / step;
+        
+        // summing by parts as above, so that the terms don't depend on each other
+        double * dx = malloc(len * sizeof(double));
+        for (int j = 0; j < len - 1; j++) dx[j] = (double)series[j] - series[j+1];
+        
+        for (int i = 0; i < len; i++) {
+            
+            int end = len - i < nw ? len : i + nw;
+            double ti = times[i];
+            double sum = 0;
+            int j = i;
+            
+            // the lags only grow with j, so the ticks within the whole lag table come first ...
+            for (; j < end - 1; j++) {
+                double tau = (ti - times[j]) * perStep;
+                if (tau >= L.nTable - 1 && L.nSlots > 0) break;
+                sum += fdLagCumWeight(&L, tau) * dx[j];
+            }
+            
+            // ... and all the rest are on the log grid, with nothing to check per tick
+            double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (; j + 4 <= end - 1; j += 4) {
+                s0 += fdLagGrid(&L, (ti - times[j]) * perStep) * dx[j];
+                s1 += fdLagGrid(&L, (ti - times[j+1]) * perStep) * dx[j+1];
+                s2 += fdLagGrid(&L, (ti - times[j+2]) * perStep) * dx[j+2];
+                s3 += fdLagGrid(&L, (ti - times[j+3]) * perStep) * dx[j+3];
+            }
+            for (; j < end - 1; j++) s0 += fdLagGrid(&L, (ti - times[j]) * perStep) * dx[j];
+            
+            df_temp[i] = sum + (s0 + s1) + (s2 + s3) + fdLagCumWeight(&L, (ti - times[end-1]) * perStep) * series[end-1];
+        }
+        
+        free(dx);
+        fdLagSFree(&L);
+    }
+    
+    free(pos);
+    free(table);
+    
+    return df_temp;
+}
+
+// main program to test the algorithm w/ some default data
+
+// (define FRACDIFF_NO_MAIN to leave it out when this file is built into something else, e.g. the Python module)
+
+#ifndef FRACDIFF_NO_MAIN
+
+// made up forecast paths for the envelope check in main():  ctx points to the number of steps
+
+static void fdCheckPathSource(void * ctx, long path, float * values) {
+    int h = *(int *)ctx;
+    for (int s = 0; s < h; s++) values[s] = sinf(1.3f * path + 0.7f * s) * (1 + 0.1f * s);
+}
+
+// the plain window loop, one weight at a time, for the fixed kernel check (no FMA, same as the kernels)
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+FD_NO_FMA static void fdCheckPlainConvolve(const float * series, int len, const float * weights, int nw, float * out) {
+    for (int i = 0; i < len; i++) {
+        float sum = 0;
+        for (int j = i; j < len && j < i + nw; j++) sum += series[j] * weights[j-i];
+        out[i] = sum;
+    }
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT ON
+#endif
+
+// qsort order for the envelope check
+
+static int fdCheckCompare(const void * a, const void * b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, const char * argv[]) {
+    
+        // test the weight generation routine
+        
+        int len = 10;
+
+        // the "series" array is the time series we will difference
+
+        // if this is considered a price time series, the most recent price is first
+        // and the oldest price is last
+    
+        // so for this example, an ordinary difference of the first value - the value
+        // immediately previous in time is:  series[0]-series[1] = 2-1 = 1
+    
+        // if you add or delete values from this array, don't forget to change the variable len above correspondingly
+    
+        float series[] = {2, 1, 3, 5, 6,   0, -1, 2, 2, 5};
+
+        float tolerance = 0; // just use all weights for now, don't set a cutoff tolerance
+    
+        int useNWeights = 0; // if useNWeights != 0, the operation isn't revers
+    
+        // difflevel notes:
+    
+        // if we set this to 1, fd (fractional difference) series becomes the ordinary day to day difference
+    
+        // if we set this to -1, the result is an ordinary definite integral (cumulative sum, assuming time deltas of 1)
+        // for the case of -1 (ordinary definite integral):
+        // first value of the resulting array should match the full sum of the above series (computed below for reference).
+        // e.g. array element 0 to the end of the array (index len-1)
+    
+        // the second value of the resulting array should match the sum of the series from array element [1] (2nd element since we are
+        // in C code with 0-indexed arrays) to the end of the series
+    
+        // and so on
+    
+        // interesting experiment to try:
+        // set difflevel close to 0 (e.g. 0.01), you get a slightly modified version of your orig series
+        // a very mild high-pass filter
+    
+        float difflevel = 0.5;
+    
+        // for ref:  sum of orig series (integral with delta t = 1)
+    
+        float sumseries = 0;
+        for (int i = 0; i < len; i++) sumseries += series[i];
+    
+        printf("sum of orig series = %f\n", sumseries);
+    
+        float * w = findWeights_ffd(difflevel, len, tolerance, useNWeights);
+    
+        // sum the weights to see what they look like in aggregate.
+        // this is just for exploration purposes.  do they sum to something
+        // interesting like 0, 1, or -1?
+    
+        float sum = 0;
+        for (int i = 0; i < len; i++) {
+            printf("w[%d] = %f\n", i, w[i]);
+            sum += w[i];
+        }
+        
+        printf("sum of wts = %f\n", sum);
+        
+        free(w);
+        
+        // test the fractional differencing on above defined series
+    
+        // fd = fractional difference
+    
+        float * fd = fracDiff(series, len, difflevel, tolerance, useNWeights);
+        
+        // dump out results, compare to orig
+        
+        for (int i = 0; i < len; i++)
+            printf("orig = %f fd = %f\n", series[i], fd[i]);
+        
+        // re-integrate the differenced series by using -difflevel,
+        // should get orig result back maybe w/ a little numeric noise
+    
+        // fi = fractional integral
+    
+        float * fi = fracDiff(fd, len, -difflevel, tolerance, useNWeights);
+        
+        for (int i = 0; i < len; i++)
+            printf("redo orig = %f fi = %f\n", series[i], fi[i]);
+        
+        // same fractional difference done in the frequency domain, should match fd
+        // to about float precision
+    
+        float * fs = fracDiffSpectral(series, len, difflevel);
+        
+        for (int i = 0; i < len; i++)
+            printf("fd = %f spectral fd = %f\n", fd[i], fs[i]);
+        
+        free(fs);
+        
+        // threaded version, same numbers exactly
+        // (this series is too short to be worth splitting, so it just runs on this thread,
+        // but the same call is what to use on long series)
+    
+        float * fp = fracDiffParallel(series, len, difflevel, tolerance, useNWeights);
+        
+        for (int i = 0; i < len; i++)
+            printf("fd = %f threaded fd = %f\n", fd[i], fp[i]);
+        
+        free(fp);
+        
+        // the compile time weight tables should be the exact same bits as the weights computed at run time
+    
+        int tablesMatch = 1;
+        float tabled[] = {(float)0.3f, (float)0.4f, (float)0.5f};
+        for (int t = 0; t < 3; t++) {
+            float * wr = findWeights_ffd(tabled[t], 128, 0, 128);
+            tablesMatch &= memcmp(wr, findWeights_ffd_const(tabled[t], 128), 128 * sizeof(float)) == 0;
+            free(wr);
+        }
+        printf("compile time weight tables match run time weights:  %s\n", tablesMatch ? "yes" : "NO");
+        
+        // d = -1 is the plain cumulative sum, output i is the sum of the series from i to the end, the first one being
+        // sumseries from above.  With the O(n) scan on, the threaded version gives the same bits
+    
+        {
+            fdSetIntegerScan(1);
+            float * cs = fracDiff(series, len, -1, 0, 0);
+            float * cp = fracDiffParallel(series, len, -1, 0, 0);
+            fdSetIntegerScan(0);
+            int scanOk = memcmp(cs, cp, len * sizeof(float)) == 0 && cs[0] == sumseries;
+            for (int i = 0; i < len; i++) {
+                double tail = 0;
+                for (int j = i; j < len; j++) tail += series[j];
+                scanOk &= fabs(cs[i] - tail) < 1e-5;
+            }
+            printf("d = -1 gives the cumulative sums:  %s\n", scanOk ? "yes" : "NO");
+            free(cs);
+            free(cp);
+        }
+        
+        // the exact inverse should undo fracDiff even with the weights cut off, where fracDiff with -d does not:
+        // a 3 weight window on the short series (direct solve), and all the weights on a longer one (the FFT route)
+    
+        {
+            float * fdt = fracDiff(series, len, difflevel, 0, 3);
+            float * back = fracDiffInvert(fdt, len, difflevel, 0, 3);
+            double err = 0;
+            for (int i = 0; i < len; i++) err = fmax(err, fabs(back[i] - series[i]));
+            free(fdt);
+            free(back);
+            
+            int longLen = 1000;
+            float * x = malloc(longLen * sizeof(float));
+            for (int i = 0; i < longLen; i++) x[i] = 100 + 10 * sinf(0.05f * i) + 0.1f * i;
+            fdt = fracDiff(x, longLen, difflevel, 0, 0);
+            back = fracDiffInvert(fdt, longLen, difflevel, 0, 0);
+            for (int i = 0; i < longLen; i++) err = fmax(err, fabs(back[i] - x[i]) / 100);
+            free(fdt);
+            free(back);
+            free(x);
+            printf("exact inverse undoes truncated and full fracDiff (max error %g):  %s\n", err, err < 1e-4 ? "yes" : "NO");
+        }
+        
+        // a pipeline of two truncated fractional differences runs as one pass, and should give the same as
+        // calling fracDiff() twice (to float rounding, the product weights are summed in a different order)
+    
+        {
+            fdPipeline * pipe = fdPipelineCreate();
+            fdPipelineAdd(pipe, 0.4f, 0, 5);
+            fdPipelineAdd(pipe, 0.3f, 0, 7);
+            float * fused = fdPipelineRun(pipe, series, len);
+            float * step1 = fracDiff(series, len, 0.4f, 0, 5);
+            float * step2 = fracDiff(step1, len, 0.3f, 0, 7);
+            double err = 0;
+            for (int i = 0; i < len; i++) err = fmax(err, fabs(fused[i] - step2[i]));
+            printf("fused pipeline matches chained fracDiff (max error %g):  %s\n", err, err < 1e-5 ? "yes" : "NO");
+            free(fused);
+            free(step1);
+            free(step2);
+            fdPipelineDestroy(pipe);
+        }
+        
+        // applyFilter() with fracDiff's own weights is the same engine, so the same bits; the threaded and FFT backends
+        // of the same filter (here an exponential taper on a longer series) should agree with it
+    
+        {
+            float * wts = findWeights_ffd(difflevel, len, 0, 0);
+            float * af = malloc(len * sizeof(float));
+            applyFilter(series, len, wts, len, af);
+            int filterOk = memcmp(af, fd, len * sizeof(float)) == 0;
+            free(af);
+            free(wts);
+            
+            int longLen = 2000, K = 300;
+            float * x = malloc(longLen * sizeof(float));
+            float * taper = malloc(K * sizeof(float));
+            float * direct = malloc(longLen * sizeof(float));
+            float * threaded = malloc(longLen * sizeof(float));
+            float * byFFT = malloc(longLen * sizeof(float));
+            for (int i = 0; i < longLen; i++) x[i] = 100 + 10 * sinf(0.05f * i);
+            for (int k = 0; k < K; k++) taper[k] = 0.05f * expf(-0.05f * k);
+            applyFilter(x, longLen, taper, K, direct);
+            applyFilterParallel(x, longLen, taper, K, threaded);
+            applyFilterFFT(x, longLen, taper, K, byFFT);
+            filterOk &= memcmp(direct, threaded, longLen * sizeof(float)) == 0;
+            for (int i = 0; i < longLen; i++) filterOk &= fabsf(direct[i] - byFFT[i]) <= 1e-5f * fabsf(direct[i]);
+            printf("applyFilter matches fracDiff, and its threaded and FFT versions agree:  %s\n", filterOk ? "yes" : "NO");
+            free(x);
+            free(taper);
+            free(direct);
+            free(threaded);
+            free(byFFT);
+        }
+        
+        // forecasts on the differenced scale back to levels:  the inverter should give the same as putting the forecasts
+        // in front of the differenced history and integrating the whole longer array with -d
+    
+        {
+            int horizon = 4;
+            float forecast[] = {0.3f, -0.2f, 0.5f, 0.1f};  // next step first
+            fdForecastInverter * inv = fdForecastInverterCreate(fd, len, difflevel, 0, 0, horizon);
+            float levels[4];
+            fdForecastInvert(inv, forecast, horizon, levels);
+            
+            float * ext = malloc((len + horizon) * sizeof(float));  // most recent first, so the last forecast goes first
+            for (int s = 0; s < horizon; s++) ext[horizon-1-s] = forecast[s];
+            memcpy(ext + horizon, fd, len * sizeof(float));
+            float * full = fracDiff(ext, len + horizon, -difflevel, 0, 0);
+            double err = 0;
+            for (int s = 0; s < horizon; s++) err = fmax(err, fabs(levels[s] - full[horizon-1-s]));
+            printf("forecast inverter matches a full reintegration (max error %g):  %s\n", err, err < 1e-4 ? "yes" : "NO");
+            free(full);
+            free(ext);
+            fdForecastInverterDestroy(inv);
+        }
+        
+        // streaming quantile envelopes of simulated paths (inverted to levels) against sorting all the levels at each step:
+        // each quantile should be within the sketch's relative accuracy of the sorted value at that rank
+    
+        {
+            int h = 5;
+            long nPaths = 5000;
+            double quantiles[] = {0.05, 0.5, 0.95};
+            double accuracy = 0.001;
+            float * levelSeries = malloc(len * sizeof(float));
+            for (int i = 0; i < len; i++) levelSeries[i] = 100 + series[i];
+            float * ldf = fracDiff(levelSeries, len, difflevel, 0, 0);
+            fdForecastInverter * inv = fdForecastInverterCreate(ldf, len, difflevel, 0, 0, h);
+            float envelopes[3 * 5];
+            fdQuantileEnvelopes(inv, fdCheckPathSource, &h, nPaths, h, quantiles, 3, accuracy, envelopes);
+            
+            float * all = malloc(nPaths * h * sizeof(float));  // [step][path]
+            float values[5] = {0}, levels[5];
+            for (long p = 0; p < nPaths; p++) {
+                fdCheckPathSource(&h, p, values);
+                fdForecastInvert(inv, values, h, levels);
+                for (int s = 0; s < h; s++) all[s * nPaths + p] = levels[s];
+            }
+            int envOk = 1;
+            for (int s = 0; s < h; s++) {
+                qsort(all + s * nPaths, nPaths, sizeof(float), fdCheckCompare);
+                for (int q = 0; q < 3; q++) {
+                    float exact = all[s * nPaths + (long)(quantiles[q] * (nPaths - 1))];
+                    envOk &= fabs(envelopes[q * h + s] - exact) <= 1.01 * accuracy * fabs(exact);
+                }
+            }
+            printf("quantile envelopes match sorted levels to the sketch accuracy:  %s\n", envOk ? "yes" : "NO");
+            free(all);
+            fdForecastInverterDestroy(inv);
+            free(ldf);
+            free(levelSeries);
+        }
+        
+        // ARFIMA paths:  a path is the same whether it is made on its own or in a batch on the pool, and
+        // fractionally differencing it with d gives back the noise it was made from (no AR / MA part here)
+    
+        {
+            int pathLen = 256, nPaths = 6;
+            fdArfima * gen = fdArfimaCreate(0.3f, pathLen, NULL, 0, NULL, 0, 1, 42);
+            float * batch = malloc(nPaths * pathLen * sizeof(float));
+            float * one = malloc(pathLen * sizeof(float));
+            double * noise = malloc(pathLen * sizeof(double));
+            fdArfimaPaths(gen, 0, nPaths, batch);
+            fdArfimaPath(gen, 3, one);
+            int arfimaOk = memcmp(one, batch + 3 * pathLen, pathLen * sizeof(float)) == 0;
+            
+            float * back = fracDiff(one, pathLen, 0.3f, 0, 0);
+            fdArfimaNoise(gen, 3, noise); // time order, oldest first
+            for (int t = 0; t < pathLen; t++) arfimaOk &= fabs(back[pathLen-1-t] - noise[t]) < 1e-4;
+            printf("ARFIMA paths are reproducible and difference back to their noise:  %s\n", arfimaOk ? "yes" : "NO");
+            free(back);
+            free(noise);
+            free(one);
+            free(batch);
+            fdArfimaDestroy(gen);
+        }
+        
+        // fGn:  the sample autocovariance over many paths should match the exact fGn autocovariance
+        // gamma(k) = sigma^2/2 (|k+1|^2H - 2|k|^2H + |k-1|^2H) to within sampling error, and H outside (0,1) is refused
+    
+        {
+            double H = 0.7;
+            int pathLen = 64, nPaths = 4000;
+            fdFgn * gen = fdFgnCreate(H, pathLen, 1, 7);
+            float * paths = malloc((size_t)nPaths * pathLen * sizeof(float));
+            fdFgnPaths(gen, 0, nPaths, paths);
+            int fgnOk = fdFgnCreate(1.0, pathLen, 1, 7) == NULL;
+            for (int k = 0; k < 4; k++) {
+                double sum = 0;
+                for (int p = 0; p < nPaths; p++)
+                    for (int t = 0; t + k < pathLen; t++) sum += (double)paths[p*pathLen + t] * paths[p*pathLen + t + k];
+                double sample = sum / ((double)nPaths * (pathLen - k));
+                double theory = 0.5 * (pow(k + 1, 2*H) - 2 * pow(k, 2*H) + pow(fabs(k - 1.0), 2*H));
+                fgnOk &= fabs(sample - theory) < 0.03;
+            }
+            printf("fGn sample autocovariance matches theory:  %s\n", fgnOk ? "yes" : "NO");
+            free(paths);
+            fdFgnDestroy(gen);
+        }
+        
+        // masked fracDiff:  with no gaps it is fracDiff in deterministic mode bit for bit; with a gap, carry forward
+        // matches fracDiff of the forward filled series, and propagate makes the outputs that reach the gap NaN
+    
+        {
+            unsigned char allThere[2] = {0xff, 0xff};
+            fdSetDeterministic(1);
+            float * det = fracDiff(series, len, difflevel, 0, 0);
+            fdSetDeterministic(0);
+            float * masked = fracDiffMasked(series, len, allThere, difflevel, 0, 0, FD_NAN_SKIP);
+            int maskOk = memcmp(masked, det, len * sizeof(float)) == 0;
+            free(masked);
+            free(det);
+            
+            int gap = 4;
+            unsigned char withGap[2] = {0xff, 0xff};
+            withGap[gap / 8] &= ~(1 << (gap % 8));
+            float filled[sizeof(series) / sizeof(series[0])];
+            memcpy(filled, series, sizeof(filled));
+            filled[gap] = filled[gap + 1]; // the value before it in time
+            float * carried = fracDiffMasked(series, len, withGap, difflevel, 0, 0, FD_NAN_CARRY);
+            float * ref = fracDiff(filled, len, difflevel, 0, 0);
+            for (int i = 0; i < len; i++) maskOk &= fabsf(carried[i] - ref[i]) < 1e-5f;
+            float * propagated = fracDiffMasked(series, len, withGap, difflevel, 0, 0, FD_NAN_PROPAGATE);
+            for (int i = 0; i < len; i++) maskOk &= !isnan(propagated[i]) == (i > gap);
+            printf("masked fracDiff matches fracDiff with no gaps, and carry / propagate handle a gap:  %s\n", maskOk ? "yes" : "NO");
+            free(carried);
+            free(ref);
+            free(propagated);
+        }
+        
+        // a ragged panel (long and short series) on a pool of 3 workers, whatever NUMA nodes they landed on:
+        // every output should be the same bits as fracDiff() on that series alone (on a one node host this only covers
+        // the calloc path, the first touch placement needs a multi socket host to run)
+    
+        {
+            int lens[] = {1500, 40, 700, 1, 2500};
+            float * panel[5];
+            for (int k = 0; k < 5; k++) {
+                panel[k] = malloc(lens[k] * sizeof(float));
+                for (int i = 0; i < lens[k]; i++) panel[k][i] = 100 + 10 * sinf(0.01f * (k + 1) * i);
+            }
+            fdSetPoolSize(3);
+            float ** outs = fracDiffPanel(panel, lens, 5, difflevel, 0, 0);
+            fdSetPoolSize(-1); // back to the default size
+            int panelOk = fdNumaNodes() >= 1;
+            for (int k = 0; k < 5; k++) {
+                float * single = fracDiff(panel[k], lens[k], difflevel, 0, 0);
+                panelOk &= memcmp(single, outs[k], lens[k] * sizeof(float)) == 0;
+                free(single);
+                free(outs[k]);
+                free(panel[k]);
+            }
+            free(outs);
+            printf("panel fracDiff on %d NUMA node(s) matches fracDiff per series:  %s\n", fdNumaNodes(), panelOk ? "yes" : "NO");
+        }
+        
+        // whole d (1, 2, -1, -2) on a long series:  with the scan off (the default), the integer d shortcuts give the
+        // same bits as the general loop, here applyFilter() with the weights from findWeights_ffd()
+
+        {
+            int nInt = 3000;
+            float * walk = malloc(nInt * sizeof(float));
+            float * general = malloc(nInt * sizeof(float));
+            for (int i = 0; i < nInt; i++) walk[i] = 100 + 10 * sinf(0.011f * i) + 0.3f * cosf(1.9f * i);
+            int intOk = 1;
+            float wholeD[] = {1, 2, -1, -2};
+            for (int t = 0; t < 4; t++) {
+                float * w = findWeights_ffd(wholeD[t], nInt, 0, 0);
+                applyFilter(walk, nInt, w, nInt, general);
+                float * fast = fracDiff(walk, nInt, wholeD[t], 0, 0);
+                intOk &= memcmp(fast, general, nInt * sizeof(float)) == 0;
+                free(fast);
+                free(w);
+            }
+            printf("whole d = 1, 2, -1, -2 give the same bits as the general loop:  %s\n", intOk ? "yes" : "NO");
+            free(walk);
+            free(general);
+        }
+
+        // a panel mixing long and short series with negative whole d and a 16 weight window, scan on:  the short ones
+        // (no longer than the window) are scans in fracDiff(), the long ones are not, and the panel has to do the same,
+        // series by series.  Then the same panel with no window, where all of them are scans
+
+        {
+            int lens[] = {3000, 10, 2500, 7, 16};
+            float * panel[5];
+            for (int k = 0; k < 5; k++) {
+                panel[k] = malloc(lens[k] * sizeof(float));
+                for (int i = 0; i < lens[k]; i++) panel[k][i] = 0.5f * sinf(0.07f * (k + 1) * i) + 0.01f * (i % 5);
+            }
+            fdSetIntegerScan(1);
+            fdSetPoolSize(3);
+            int scanPanelOk = 1;
+            for (int window = 16; window >= 0; window -= 16) {
+                float ** outs = fracDiffPanel(panel, lens, 5, -1, 0, window);
+                for (int k = 0; k < 5; k++) {
+                    float * single = fracDiff(panel[k], lens[k], -1, 0, window);
+                    scanPanelOk &= memcmp(single, outs[k], lens[k] * sizeof(float)) == 0;
+                    free(single);
+                    free(outs[k]);
+                }
+                free(outs);
+            }
+            fdSetPoolSize(-1);
+            fdSetIntegerScan(0);
+            for (int k = 0; k < 5; k++) free(panel[k]);
+            printf("panel with d = -1 and long and short series matches fracDiff per series:  %s\n", scanPanelOk ? "yes" : "NO");
+        }
+
+        // only some outputs:  strided (from > 0, stride 1 and 7) and a list of indices, full memory and a 50 weight window,
+        // against the same outputs of fracDiff()
+
+        {
+            int nSome = 1000;
+            float * walk = malloc(nSome * sizeof(float));
+            float * some = malloc(nSome * sizeof(float));
+            for (int i = 0; i < nSome; i++) walk[i] = 100 + 5 * sinf(0.021f * i) + 0.2f * cosf(2.3f * i);
+            int indices[] = {999, 0, 517, 3, 950, 517, 42};
+            int someOk = 1;
+            for (int window = 0; window <= 50; window += 50) {
+                float * full = fracDiff(walk, nSome, difflevel, 0, window);
+                for (int stride = 1; stride <= 7; stride += 6) {
+                    int count = fracDiffStrided(walk, nSome, difflevel, 0, window, 13, nSome - 5, stride, some);
+                    someOk &= count == (nSome - 5 - 13 + stride - 1) / stride;
+                    for (int k = 0; k < count; k++) someOk &= memcmp(&some[k], &full[13 + k * stride], sizeof(float)) == 0;
+                }
+                fracDiffIndices(walk, nSome, difflevel, 0, window, indices, 7, some);
+                for (int k = 0; k < 7; k++) someOk &= memcmp(&some[k], &full[indices[k]], sizeof(float)) == 0;
+                free(full);
+            }
+            printf("strided and indexed outputs are the same bits as fracDiff's:  %s\n", someOk ? "yes" : "NO");
+            free(walk);
+            free(some);
+        }
+
+        // the lazy view with room for only 2 of its 4 blocks, read all over the place (so blocks get dropped and made
+        // again):  every read should be the same bits as fracDiff(), and NaN outside the series
+
+        {
+            int nLazy = 3 * FD_LAZY_BLOCK + 100;
+            float * walk = malloc(nLazy * sizeof(float));
+            for (int i = 0; i < nLazy; i++) walk[i] = 100 + 5 * sinf(0.017f * i) + 0.2f * cosf(2.9f * i);
+            float * full = fracDiff(walk, nLazy, difflevel, 0, 0);
+            fdLazyView * view = fdLazyCreate(walk, nLazy, difflevel, 0, 0, 2 * FD_LAZY_BLOCK * sizeof(float));
+            int lazyOk = isnan(fdLazyGet(view, -1)) && isnan(fdLazyGet(view, nLazy));
+            for (int r = 0; r < 3 * nLazy; r++) {
+                int i = (int)((r * 7919L + (r % 3) * 257) % nLazy);
+                float v = fdLazyGet(view, i);
+                lazyOk &= memcmp(&v, &full[i], sizeof(float)) == 0;
+            }
+            fdLazyDestroy(view);
+            printf("lazy view reads are the same bits as fracDiff's, with blocks dropped and made again:  %s\n", lazyOk ? "yes" : "NO");
+            free(full);
+            free(walk);
+        }
+
+        // boundary modes with a 20 weight window:  FULL is fracDiff(), VALID its first len-19 outputs, and the pads are
+        // fracDiff() of the series with 19 more values after its end (padValue, or the mirror image), cut back to len
+        // outputs.  The constant pad adds the left out weights on separately, so it is only checked to float rounding
+
+        {
+            int nB = 300, window = 20;
+            float padValue = 100;
+            float * walk = malloc((nB + window - 1) * sizeof(float));
+            for (int i = 0; i < nB; i++) walk[i] = 100 + 5 * sinf(0.05f * i) + 0.2f * cosf(1.7f * i);
+            float * full = fracDiff(walk, nB, difflevel, 0, window);
+            int nFull, nValid, nConst, nMirror;
+            float * bFull = fracDiffBoundary(walk, nB, difflevel, 0, window, FD_BOUNDARY_FULL, 0, &nFull);
+            float * bValid = fracDiffBoundary(walk, nB, difflevel, 0, window, FD_BOUNDARY_VALID, 0, &nValid);
+            float * bConst = fracDiffBoundary(walk, nB, difflevel, 0, window, FD_BOUNDARY_PAD_CONSTANT, padValue, &nConst);
+            float * bMirror = fracDiffBoundary(walk, nB, difflevel, 0, window, FD_BOUNDARY_PAD_MIRROR, 0, &nMirror);
+            int boundOk = nFull == nB && nValid == nB - window + 1 && nConst == nB && nMirror == nB;
+            boundOk &= memcmp(bFull, full, nB * sizeof(float)) == 0 && memcmp(bValid, full, nValid * sizeof(float)) == 0;
+
+            for (int j = nB; j < nB + window - 1; j++) walk[j] = padValue;
+            float * padded = fracDiff(walk, nB + window - 1, difflevel, 0, window);
+            double padErr = 0;
+            for (int i = 0; i < nB; i++) padErr = fmax(padErr, fabs(bConst[i] - padded[i]));
+            boundOk &= padErr < 1e-4;
+            free(padded);
+
+            for (int j = nB; j < nB + window - 1; j++) walk[j] = walk[2 * (nB - 1) - j];
+            float * mirrored = fracDiff(walk, nB + window - 1, difflevel, 0, window);
+            boundOk &= memcmp(bMirror, mirrored, nB * sizeof(float)) == 0;
+            free(mirrored);
+
+            printf("boundary modes match fracDiff and fracDiff of the padded series (constant pad error %g):  %s\n",
+                   padErr, boundOk ? "yes" : "NO");
+            free(bFull);
+            free(bValid);
+            free(bConst);
+            free(bMirror);
+            free(full);
+            free(walk);
+        }
+
+        // revisions to old values (one index revised twice, one past the end that should be skipped), full memory and
+        // a 30 weight window:  the patched outputs against a full rerun on the revised series, to float rounding
+
+        {
+            int nRev = 500;
+            float * walk = malloc(nRev * sizeof(float));
+            int revIdx[] = {10, 250, 499, 250, 7, nRev};
+            float revVal[] = {101.5f, 98.0f, 100.25f, 97.5f, 102.0f, 0.0f};
+            double revErr = 0;
+            for (int window = 0; window <= 30; window += 30) {
+                for (int i = 0; i < nRev; i++) walk[i] = 100 + 2 * sinf(0.03f * i);
+                float * patched = fracDiff(walk, nRev, difflevel, 0, window);
+                fracDiffRevise(walk, nRev, difflevel, 0, window, patched, revIdx, revVal, 6);
+                float * rerun = fracDiff(walk, nRev, difflevel, 0, window);
+                for (int i = 0; i < nRev; i++) revErr = fmax(revErr, fabs(patched[i] - rerun[i]));
+                free(patched);
+                free(rerun);
+            }
+            int revOk = revErr < 1e-4 && walk[250] == 97.5f && walk[10] == 101.5f;
+            printf("revised outputs match a full rerun (max abs error %g):  %s\n", revErr, revOk ? "yes" : "NO");
+            free(walk);
+        }
+
+        // the mass dropped by a 100 weight window over 2000 points (and fdTailMass of a middle stretch) against the
+        // dropped weights summed directly, with recurrence [A] in double
+
+        {
+            int nDrop = 2000, kept = 100;
+            float * walk = malloc(nDrop * sizeof(float));
+            for (int i = 0; i < nDrop; i++) walk[i] = 100 + sinf(0.03f * i);
+            free(fracDiff(walk, nDrop, difflevel, 0, kept));
+            double dropped = fdDroppedMass();
+            double wk = 1, tail = 0, middle = 0;
+            for (int k = 1; k < nDrop; k++) {
+                wk = -wk * ((double)difflevel - k + 1) / k;
+                if (k >= kept) tail += wk;
+                if (k >= 10 && k < 500) middle += wk;
+            }
+            double dropErr = fmax(fabs(dropped - tail) / fabs(tail), fabs(fdTailMass(difflevel, 10, 500) - middle) / fabs(middle));
+            printf("dropped weight mass matches the direct sum of the dropped weights (rel error %g):  %s\n",
+                   dropErr, dropErr < 1e-9 ? "yes" : "NO");
+            free(walk);
+        }
+
+        // fixed window kernels (K = 16, 32, 64, 128) against the plain loop:  lengths that leave a partial block of 8
+        // before the window runs off the end, and one shorter than the window, so only the run off loop does anything
+
+        {
+            int fixedOk = 1;
+            float * walk = malloc((3 * 128 + 5) * sizeof(float));
+            float * fast = malloc((3 * 128 + 5) * sizeof(float));
+            float * plain = malloc((3 * 128 + 5) * sizeof(float));
+            for (int i = 0; i < 3 * 128 + 5; i++) walk[i] = 100 + 10 * sinf(0.05f * i) + cosf(2.1f * i);
+            for (int K = 16; K <= 128; K *= 2) {
+                float * w = findWeights_ffd(difflevel, K, 0, 0);
+                int fixedLens[] = {K + 13, 3 * K + 5, K - 3};
+                for (int t = 0; t < 3; t++) {
+                    int n = fixedLens[t];
+                    fdConvolveRange(walk, n, w, K, 0, n, fast);
+                    fdCheckPlainConvolve(walk, n, w, K, plain);
+                    fixedOk &= memcmp(fast, plain, n * sizeof(float)) == 0;
+                    memset(fast, 0, n * sizeof(float));
+                    fdConvolveRange(walk, n, w, K, 3, n - 1, fast);  // a range not starting at 0 or ending at len too
+                    fixedOk &= memcmp(fast + 3, plain + 3, (n - 4) * sizeof(float)) == 0;
+                }
+                free(w);
+            }
+            printf("fixed window kernels for 16, 32, 64, 128 weights match the plain loop, tails included:  %s\n", fixedOk ? "yes" : "NO");
+            free(walk);
+            free(fast);
+            free(plain);
+        }
+
+        // deterministic mode:  fracDiffInto() and fracDiffParallel() on pools of 0, 1 and 3 workers should all give the
+        // same bits (length not a multiple of FD_LANES, and long enough for the threaded split)
+
+        {
+            int nDet = 5 * FD_PARALLEL_MIN_LEN + 7;
+            float * walk = malloc(nDet * sizeof(float));
+            float * into = malloc(nDet * sizeof(float));
+            for (int i = 0; i < nDet; i++) walk[i] = 100 + 10 * sinf(0.013f * i) + 0.1f * cosf(1.3f * i);
+            fdSetDeterministic(1);
+            fracDiffInto(walk, nDet, difflevel, 0, 0, into);
+            int detOk = 1;
+            int poolSizes[] = {0, 1, 3};
+            for (int p = 0; p < 3; p++) {
+                fdSetPoolSize(poolSizes[p]);
+                float * par = fracDiffParallel(walk, nDet, difflevel, 0, 0);
+                detOk &= memcmp(par, into, nDet * sizeof(float)) == 0;
+                free(par);
+            }
+            fdSetPoolSize(-1);
+            fdSetDeterministic(0);
+            printf("deterministic fracDiffInto and fracDiffParallel on 0, 1 and 3 workers give the same bits:  %s\n", detOk ? "yes" : "NO");
+            free(walk);
+            free(into);
+        }
+
+        // 16 bit storage:  fracDiff16 against the float path on a walk around 100 (tolerances a few times the measured
+        // errors in the notes at fdPack16), and values that 16 bits hold exactly, inf and nan surviving a round trip
+        // (16 of them so the F16C block and the one at a time tail both run)
+
+        {
+            int n16 = 2000;
+            float * walk = malloc(n16 * sizeof(float));
+            uint16_t * walk16 = malloc(n16 * sizeof(uint16_t));
+            float * back = malloc(n16 * sizeof(float));
+            float price = 100;
+            for (int i = 0; i < n16; i++) {
+                price += sinf(1.7f * i * i + 0.3f * i) > 0 ? 0.5f : -0.5f;
+                walk[i] = price;
+            }
+            float * ref = fracDiff(walk, n16, 0.4, 0, 0);
+            float refMax = 0;
+            for (int i = 0; i < n16; i++) refMax = fmaxf(refMax, fabsf(ref[i]));
+
+            float exact[16] = {0.0f, -0.0f, 1.0f, -2.5f, 0.375f, 1024.0f, -0.125f, 3.0f,
+                               57344.0f, 5.9604644775390625e-8f, INFINITY, -INFINITY, NAN, 0.5f, -96.0f, 6.103515625e-5f};
+            int ok16 = 1;
+            double err16[2];
+            for (int format = FD_FP16; format <= FD_BF16; format++) {
+                fdPack16(walk, walk16, n16, format);
+                uint16_t * out16 = fracDiff16(walk16, n16, 0.4, 0, 0, format);
+                fdUnpack16(out16, back, n16, format);
+                err16[format] = 0;
+                for (int i = 0; i < n16; i++) err16[format] = fmax(err16[format], fabs(back[i] - ref[i]));
+                ok16 &= err16[format] < (format == FD_FP16 ? 2e-3 : 1.5e-2) * refMax;
+                free(out16);
+
+                uint16_t packed[16];
+                float unpacked[16];
+                fdPack16(exact, packed, 16, format);
+                fdUnpack16(packed, unpacked, 16, format);
+                for (int i = 0; i < 16; i++) {
+                    if (isnan(exact[i])) ok16 &= isnan(unpacked[i]) != 0;
+                    else ok16 &= memcmp(&unpacked[i], &exact[i], sizeof(float)) == 0;  // same bits, so -0 stays -0
+                }
+            }
+            printf("fp16 / bf16 fracDiff16 within tolerance of float (max abs error %g / %g of max %g) and round trips keep inf, nan:  %s\n",
+                   err16[FD_FP16], err16[FD_BF16], refMax, ok16 ? "yes" : "NO");
+            free(ref);
+            free(walk);
+            free(walk16);
+            free(back);
+        }
+
+        // ticks with ms timestamps over a 6.5 hour session, as fracDiffIrregular() is meant for:  the lags run to over
+        // 20 million ms, well past the whole lag table.  Compare some outputs against the sum done term by term with the
+        // closed form S().  The time against applyFilter() on the same number of points (weights made beforehand) is
+        // only printed, as clock() on a shared host is too noisy to pass or fail on
+    
+        {
+            int nTicks = 5000;
+            double * times = malloc(nTicks * sizeof(double));
+            float * ticks = malloc(nTicks * sizeof(float));
+            double t = 34200 + 6.5 * 3600; // seconds since midnight, most recent tick first
+            for (int i = 0; i < nTicks; i++) {
+                t -= floor(6.5 * 3600 * 1000 / nTicks * (0.05 + 1.9 * (0.5 + 0.5 * sin(1.7 * i)))) / 1000;
+                times[i] = t;
+                ticks[i] = 100 + sinf(0.02f * i) + 0.01f * (i % 7);
+            }
+            
+            float * w = findWeights_ffd(difflevel, nTicks, 0, 0);
+            float * reg = malloc(nTicks * sizeof(float));
+            clock_t c0 = clock();
+            float * irr = fracDiffIrregular(ticks, times, nTicks, 0.001, difflevel, 0);
+            clock_t c1 = clock();
+            applyFilter(ticks, nTicks, w, nTicks, reg);
+            clock_t c2 = clock();
+            
+            double err = 0;
+            for (int i = 0; i < nTicks; i += 100) {
+                double exact = 0, prev = 0;
+                for (int j = i; j < nTicks; j++) {
+                    double S = fdCumWeight(difflevel, (times[i] - times[j]) / 0.001);
+                    exact += ticks[j] * (S - prev);
+                    prev = S;
+                }
+                err = fmax(err, fabs(irr[i] - exact) / fmax(fabs(exact), 1));
+            }
+            double ratio = (double)(c1 - c0) / (c2 - c1 > 0 ? c2 - c1 : 1);
+            printf("irregular ms ticks match the closed form (max rel error %g, %.1fx the time of applyFilter):  %s\n",
+                   err, ratio, err < 1e-6 ? "yes" : "NO");
+            free(w);
+            free(irr);
+            free(reg);
+            free(ticks);
+            free(times);
+        }
+        
+        // a batch of simulated forecast paths back to levels in one go should be the same numbers as
+        // doing each path with fdForecastInvert()
+    
+        {
+            int hLen = 300, horizon = 12, nPaths = 37;
+            float * hist = malloc(hLen * sizeof(float));
+            for (int i = 0; i < hLen; i++) hist[i] = 100 + 10 * sinf(0.05f * i) + 0.1f * i;
+            float * hdf = fracDiff(hist, hLen, difflevel, 0, 0);
+            fdForecastInverter * inv = fdForecastInverterCreate(hdf, hLen, difflevel, 0, 0, horizon);
+            float * paths = malloc(nPaths * horizon * sizeof(float));
+            float * batch = malloc(nPaths * horizon * sizeof(float));
+            float * one = malloc(horizon * sizeof(float));
+            for (int k = 0; k < nPaths * horizon; k++) paths[k] = cosf(0.37f * k);
+            fdForecastInvertPaths(inv, paths, nPaths, horizon, batch);
+            int pathsMatch = 1;
+            for (int p = 0; p < nPaths; p++) {
+                fdForecastInvert(inv, paths + p * horizon, horizon, one);
+                pathsMatch &= memcmp(one, batch + p * horizon, horizon * sizeof(float)) == 0;
+            }
+            printf("batched path inversion matches one path at a time:  %s\n", pathsMatch ? "yes" : "NO");
+            free(one);
+            free(batch);
+            free(paths);
+            fdForecastInverterDestroy(inv);
+            free(hdf);
+            free(hist);
+        }
+        
+        free(fd);
+        free(fi);
+    
+        return 0;
 }
+
+#endif